@@ -40,6 +40,7 @@
 #include "dealerinfo.h"
 #include "messagebox.h"
 #include "renderer.h"
+#include "solvercache.h"
 #include "speeds.h"
 #include "version.h"
 #include "view.h"
@@ -89,7 +90,9 @@ namespace
         return result;
     }
 
-    QString solverStatusMessage( int status, bool everWinnable )
+    // bestLine is the length of the most promising line of moves a search
+    // found when it gave up, 0 if there is none.
+    QString solverStatusMessage( int status, bool everWinnable, int bestLine = 0 )
     {
         switch ( status )
         {
@@ -99,14 +102,50 @@ namespace
             return everWinnable ? i18n("Solver: This game is no longer winnable.")
                                 : i18n("Solver: This game cannot be won.");
         case Solver::UnableToDetermineSolvability:
+            if ( bestLine > 0 )
+                return i18np("Solver: Unable to determine if this game is winnable. The hint follows the most promising line, 1 move long.",
+                             "Solver: Unable to determine if this game is winnable. The hint follows the most promising line, %1 moves long.",
+                             bestLine);
             return i18n("Solver: Unable to determine if this game is winnable.");
-        case Solver::SearchAborted:
         case Solver::MemoryLimitReached:
+        case Solver::TimeLimitReached:
+            if ( bestLine > 0 )
+                return i18np("Solver: Gave up before finding a solution. The hint follows the most promising line, 1 move long.",
+                             "Solver: Gave up before finding a solution. The hint follows the most promising line, %1 moves long.",
+                             bestLine);
+            return QString();
+        case Solver::SearchAborted:
         default:
             return QString();
         }
     }
 
+    // Whether the changes are just the given move: its card, and the ones on
+    // top of it, went to its pile, and nothing else moved. Which foundation a
+    // card goes to doesn't matter to the solvers.
+    bool isMove( const QList<CardStateChange> & changes, const MoveHint & move )
+    {
+        if ( !move.isValid() )
+            return false;
+
+        bool moved = false;
+        foreach ( const CardStateChange & change, changes )
+        {
+            if ( change.newState.pile == change.oldState.pile )
+                continue;
+
+            const PatPile * pile = dynamic_cast<PatPile*>( change.newState.pile );
+            if ( moved
+                 || change.cards.first() != move.card()
+                 || !( pile == move.pile()
+                       || ( pile && pile->isFoundation() && move.pile()->isFoundation() ) ) )
+                return false;
+
+            moved = true;
+        }
+        return moved;
+    }
+
     int readIntAttribute( const QXmlStreamReader & xml, const QString & key, bool * ok = 0 )
     {
         QStringRef value = xml.attributes().value( key );
@@ -167,36 +206,95 @@ namespace
 }
 
 
-class SolverThread : public QThread
+Q_DECLARE_METATYPE( MOVE )
+
+class SolverThread : public QThread, public SolverListener
 {
     Q_OBJECT
 
 public:
     SolverThread( Solver * solver )
-      : m_solver( solver )
+      : m_solver( solver ),
+        m_serial( 0 ),
+        m_positions( -1 ),
+        m_reported( false )
     {
+        qRegisterMetaType< QList<MOVE> >();
+    }
+
+    // The serial tells the scene which position the moves are for. With a
+    // limit of positions, the thread only takes a quick look for the moves
+    // from the position, and whether there are any left to make.
+    void start( int serial, int positions, Priority priority )
+    {
+        m_serial = serial;
+        m_positions = positions;
+        m_reported = false;
+        QThread::start( priority );
+    }
+
+    int serial() const
+    {
+        return m_serial;
+    }
+
+    bool searches() const
+    {
+        return m_positions == -1;
+    }
+
+    QList<MOVE> firstMoves() const
+    {
+        QMutexLocker lock( &m_movesMutex );
+        return m_firstMoves;
     }
 
     void run() Q_DECL_OVERRIDE
     {
-        Solver::ExitStatus result = m_solver->patsolve();
-        emit finished( result );
+        m_solver->setListener( this );
+        Solver::ExitStatus result = m_solver->patsolve( m_positions );
+        m_solver->setListener( 0 );
+
+        // With no moves to make, the search never got to tell us.
+        if ( !m_reported && result != Solver::SearchAborted )
+            firstMovesFound( m_solver->firstMoves );
+
+        // The moves go along with the signal: by the time it arrives, the
+        // solver may be busy with the next position.
+        if ( searches() )
+            emit finished( m_serial, result, m_solver->winMoves, m_solver->bestMoves );
+        else
+            emit probed( m_serial, result );
     }
 
-    void abort()
+    void firstMovesFound( const QList<MOVE> & moves ) Q_DECL_OVERRIDE
     {
         {
-            QMutexLocker lock( &m_solver->endMutex );
-            m_solver->m_shouldEnd = true;
+            QMutexLocker lock( &m_movesMutex );
+            m_firstMoves = moves;
         }
+        m_reported = true;
+        emit firstMovesKnown( m_serial );
+    }
+
+    void abort()
+    {
+        m_solver->stop();
         wait();
     }
 
 signals:
-    void finished( int result );
+    void finished( int serial, int result, const QList<MOVE> & winMoves, const QList<MOVE> & bestMoves );
+    void probed( int serial, int result );
+    void firstMovesKnown( int serial );
 
 private:
     Solver * m_solver;
+    int m_serial;
+    int m_positions;
+    bool m_reported;
+    QList<MOVE> m_firstMoves;
+    mutable QMutex m_movesMutex;
 };
 
 
@@ -541,6 +639,9 @@ DealerScene::DealerScene( const DealerInfo * di )
   : m_di( di ),
     m_solver( 0 ),
     m_solverThread( 0 ),
+    m_solverFingerprint( 0 ),
+    m_firstMovesKnown( false ),
+    m_stateSerial( 0 ),
     m_peekedCard( 0 ),
     m_dealNumber( 0 ),
     m_loadedMoveCount( 0 ),
@@ -567,6 +668,10 @@ DealerScene::DealerScene( const DealerInfo * di )
     m_dropQueued( false ),
     m_newCardsQueued( false ),
     m_takeStateQueued( false ),
+    m_hintAwaitsSolver( false ),
+    m_demoAwaitsSolver( false ),
+    m_dropAwaitsSolver( false ),
+    m_searchAwaitsProbe( false ),
     m_currentState( 0 )
 {
     setItemIndexMethod(QGraphicsScene::NoIndex);
@@ -665,6 +770,12 @@ void DealerScene::startHint()
         return;
     }
 
+    if ( awaitSolverHints() )
+    {
+        m_hintAwaitsSolver = true;
+        return;
+    }
+
     if ( isKeyboardModeActive() )
         setKeyboardModeActive( false );
 
@@ -679,6 +790,10 @@ void DealerScene::startHint()
         if ( mh.isValid() )
             toHighlight << mh.card();
     }
+    else if ( m_bestMove.isValid() )
+    {
+        toHighlight << m_bestMove.card();
+    }
 
     m_hintInProgress = !toHighlight.isEmpty();
     setHighlightedItems( toHighlight );
@@ -688,6 +803,7 @@ void DealerScene::startHint()
 
 void DealerScene::stopHint()
 {
+    m_hintAwaitsSolver = false;
     if ( m_hintInProgress )
     {
         m_hintInProgress = false;
@@ -702,21 +818,12 @@ bool DealerScene::isHintActive() const
     return m_hintInProgress;
 }
 
+// The moves are looked for in the background, see awaitSolverHints().
 QList<MoveHint> DealerScene::getSolverHints()
 {
     QList<MoveHint> hintList;
 
-    if ( m_solverThread && m_solverThread->isRunning() )
-        m_solverThread->abort();
-
-    solver()->translate_layout();
-    bool debug = false;
-#if DEBUG_HINTS
-    debug = true;
-#endif
-    solver()->patsolve( 1, debug );
-
-    foreach ( const MOVE & m, solver()->firstMoves )
+    foreach ( const MOVE & m, m_firstMoves )
     {
         MoveHint mh = solver()->translateMove( m );
 	hintList << mh;
@@ -793,6 +900,7 @@ MoveHint DealerScene::chooseHint()
     {
         MOVE m = m_winningMoves.takeFirst();
         MoveHint mh = solver()->translateMove( m );
+        m_nextWinningMove = MoveHint();
 
 #if DEBUG_HINTS
         if ( m.totype == O_Type )
@@ -806,6 +914,13 @@ MoveHint DealerScene::chooseHint()
         return mh;
     }
 
+    if ( m_bestMove.isValid() )
+    {
+        MoveHint mh = m_bestMove;
+        m_bestMove = MoveHint();
+        return mh;
+    }
+
     QList<MoveHint> hintList = getHints();
 
     if ( hintList.isEmpty() )
@@ -866,6 +981,13 @@ void DealerScene::resetInternals()
 {
     stop();
 
+    // What the solver found out about the last deal is of no use anymore.
+    if ( m_solverThread && m_solverThread->isRunning() )
+        m_solverThread->abort();
+    if ( m_solver )
+        m_solver->forgetPositions();
+    newSolverPosition();
+
     setKeyboardModeActive( false );
 
     m_dealHasBeenWon = false;
@@ -1171,6 +1293,7 @@ void DealerScene::undoOrRedo( bool undo )
         toStack.push( m_currentState );
         m_currentState = fromStack.pop();
         setGameState( m_currentState->stateData );
+        newSolverPosition();
 
         QSet<KCardPile*> pilesAffected;
         foreach ( const CardStateChange & change, changes )
@@ -1235,6 +1358,7 @@ void DealerScene::undoOrRedo( bool undo )
 
         int solvability = m_currentState->solvability;
         m_winningMoves = m_currentState->winningMoves;
+        translateNextWinningMove();
 
         emit solverStateChanged( solverStatusMessage( solvability, m_dealWasEverWinnable ) );
 
@@ -1255,8 +1379,16 @@ void DealerScene::takeState()
         return;
     }
 
+    // Hold on to the solution, the player may have made its first move.
+    QList<MOVE> solution;
+    MoveHint solutionMove;
     if ( !isDemoActive() )
+    {
+        solution = m_winningMoves;
+        solutionMove = m_nextWinningMove;
         m_winningMoves.clear();
+        m_nextWinningMove = MoveHint();
+    }
 
     QList<CardStateChange> changes;
 
@@ -1323,6 +1455,7 @@ void DealerScene::takeState()
         m_redoStack.clear();
     }
     m_currentState = new GameState( changes, getGameState() );
+    newSolverPosition();
 
     emit redoPossible( false );
     emit undoPossible( !m_undoStack.isEmpty() );
@@ -1335,16 +1468,25 @@ void DealerScene::takeState()
         return;
     }
 
-    if ( !m_toldAboutWonGame && !m_toldAboutLostGame && isGameLost() )
+    // If so, the rest of it still holds, and there is no need to look for
+    // another one.
+    const bool followedSolution = isMove( changes, solutionMove );
+    if ( followedSolution )
     {
-        emit gameInProgress( false );
-        emit solverStateChanged( i18n( "Solver: This game is lost." ) );
-        m_toldAboutLostGame = true;
-        stopDemo();
-        return;
+        solution.removeFirst();
+        m_winningMoves = solution;
+        translateNextWinningMove();
+        m_currentState->solvability = Solver::SolutionExists;
+        m_currentState->winningMoves = m_winningMoves;
+        emit solverStateChanged( solverStatusMessage( Solver::SolutionExists, m_dealWasEverWinnable ) );
     }
 
-    if ( !isDemoActive() && !isCardAnimationRunning() && m_solver )
+    // Whether the game is lost, a quick look at the position in the solver
+    // thread tells, see slotSolverProbed().
+    if ( !followedSolution && !m_toldAboutWonGame && !m_toldAboutLostGame && m_solver )
+        requestSolverHints();
+
+    if ( !followedSolution && !isDemoActive() && !isCardAnimationRunning() && m_solver )
         startSolver();
 
     if ( autoDropEnabled() && !isDropActive() && !isDemoActive() && m_redoStack.isEmpty() )
@@ -1397,6 +1539,7 @@ void DealerScene::startDrop()
 
 void DealerScene::stopDrop()
 {
+    m_dropAwaitsSolver = false;
     if ( m_dropInProgress )
     {
         m_dropTimer.stop();
@@ -1417,6 +1560,12 @@ bool DealerScene::isDropActive() const
 
 bool DealerScene::drop()
 {
+    if ( awaitSolverHints() )
+    {
+        m_dropAwaitsSolver = true;
+        return false;
+    }
+
     foreach ( const MoveHint & mh, getHints() )
     {
         if ( mh.pile()
@@ -1474,6 +1623,16 @@ void DealerScene::stopAndRestartSolver()
 
     if ( m_solverThread && m_solverThread->isRunning() )
     {
+        // It may be at this position already, and not just for the hints.
+        if ( m_solverThread->serial() == m_stateSerial && m_solverThread->searches() )
+            return;
+        // A quick look at this position is about to tell whether the game
+        // is lost, the search can wait for it.
+        if ( m_solverThread->serial() == m_stateSerial )
+        {
+            m_searchAwaitsProbe = true;
+            return;
+        }
         m_solverThread->abort();
     }
 
@@ -1493,25 +1652,183 @@ void DealerScene::slotSolverEnded()
 
     m_solver->translate_layout();
     m_winningMoves.clear();
+    m_nextWinningMove = MoveHint();
+
+    // Maybe this position has been solved before, in this session or an
+    // earlier one.
+    m_solverFingerprint = positionFingerprint();
+    const SolverCache::Key key = { gameId(), gameNumber(), m_solverFingerprint };
+    Solver::ExitStatus result;
+    QList<MOVE> winMoves;
+    if ( SolverCache::instance()->lookup( key, &result, &winMoves ) )
+    {
+        applySolverResult( result, winMoves, QList<MOVE>() );
+
+        // The cache doesn't know the other moves, the hints need them.
+        if ( !m_firstMovesKnown )
+            startSolverThread( false );
+        return;
+    }
+
     emit solverStateChanged( i18n("Solver: Calculating...") );
+    startSolverThread( true );
+}
+
+
+void DealerScene::startSolverThread( bool search )
+{
     if ( !m_solverThread )
     {
         m_solverThread = new SolverThread( m_solver );
         connect(m_solverThread, &SolverThread::finished, this, &DealerScene::slotSolverFinished);
+        connect(m_solverThread, &SolverThread::probed, this, &DealerScene::slotSolverProbed);
+        connect(m_solverThread, &SolverThread::firstMovesKnown, this, &DealerScene::slotFirstMovesKnown, Qt::QueuedConnection);
+    }
+    m_solverThread->start( m_stateSerial, search ? -1 : neededFutureMoves(),
+                           search && m_solverEnabled ? QThread::IdlePriority : QThread::NormalPriority );
+}
+
+
+// A quick look at the position, for the moves from it, also finds out if
+// the moves run out soon, whatever the player does.
+void DealerScene::slotSolverProbed( int serial, int result )
+{
+    if ( serial != m_stateSerial )
+        return;
+
+    // It is done but for returning.
+    m_solverThread->wait();
+
+    if ( result == Solver::NoSolutionExists && !m_toldAboutWonGame && !m_toldAboutLostGame )
+    {
+        m_searchAwaitsProbe = false;
+        emit gameInProgress( false );
+        emit solverStateChanged( i18n( "Solver: This game is lost." ) );
+        m_toldAboutLostGame = true;
+        stopDemo();
+        return;
+    }
+
+    if ( m_searchAwaitsProbe )
+    {
+        m_searchAwaitsProbe = false;
+        stopAndRestartSolver();
+    }
+}
+
+
+// Every search reports the moves from its position as soon as it has them.
+void DealerScene::slotFirstMovesKnown( int serial )
+{
+    if ( !m_solverThread || serial != m_stateSerial )
+    {
+        // They are for a position we have left since.
+        if ( m_hintAwaitsSolver || m_demoAwaitsSolver || m_dropAwaitsSolver )
+            requestSolverHints();
+        return;
+    }
+
+    m_firstMoves = m_solverThread->firstMoves();
+    m_firstMovesKnown = true;
+
+    if ( m_dropAwaitsSolver )
+    {
+        m_dropAwaitsSolver = false;
+        drop();
+    }
+    else if ( m_demoAwaitsSolver )
+    {
+        m_demoAwaitsSolver = false;
+        demo();
+    }
+    else if ( m_hintAwaitsSolver )
+    {
+        m_hintAwaitsSolver = false;
+        startHint();
+    }
+}
+
+
+// The position has changed, so have the moves from it.
+void DealerScene::newSolverPosition()
+{
+    ++m_stateSerial;
+    m_bestMove = MoveHint();
+    m_firstMoves.clear();
+    m_firstMovesKnown = false;
+    m_searchAwaitsProbe = false;
+}
+
+
+// Whether the solver's moves from this position are still to come. They are
+// asked for then, and slotFirstMovesKnown() carries on with what was waiting
+// for them. This way the GUI never waits for the solver, and a search that
+// is running for this position goes on.
+bool DealerScene::awaitSolverHints()
+{
+    if ( !m_solver || m_firstMovesKnown )
+        return false;
+
+    requestSolverHints();
+    return true;
+}
+
+
+void DealerScene::requestSolverHints()
+{
+    if ( m_solverThread && m_solverThread->isRunning() )
+    {
+        if ( m_solverThread->serial() == m_stateSerial )
+            return;
+        m_solverThread->abort();
+    }
+
+    m_solver->translate_layout();
+    startSolverThread( false );
+}
+
+
+void DealerScene::slotSolverFinished( int serial, int result, const QList<MOVE> & winMoves, const QList<MOVE> & bestMoves )
+{
+    // A search for a position we have left since tells us nothing, and the
+    // fingerprint it would be kept under is gone.
+    if ( serial != m_stateSerial )
+    {
+        if ( result == Solver::SearchAborted )
+            startSolver();
+        return;
     }
-    m_solverThread->start( m_solverEnabled ? QThread::IdlePriority : QThread::NormalPriority );
+
+    const SolverCache::Key key = { gameId(), gameNumber(), m_solverFingerprint };
+    SolverCache::instance()->store( key, static_cast<Solver::ExitStatus>( result ), winMoves );
+
+    applySolverResult( result, winMoves, bestMoves );
 }
 
 
-void DealerScene::slotSolverFinished( int result )
+// What the solver found out about this position, fresh or from the cache.
+// A search that gave up without an answer may still have found a line of
+// moves that gets further than the others; its first move is the hint.
+void DealerScene::applySolverResult( int result, const QList<MOVE> & winMoves, const QList<MOVE> & bestMoves )
 {
+    int bestLine = 0;
     if ( result == Solver::SolutionExists )
     {
-        m_winningMoves = m_solver->winMoves;
+        m_winningMoves = winMoves;
+        translateNextWinningMove();
         m_dealWasEverWinnable = true;
     }
+    else if ( ( result == Solver::UnableToDetermineSolvability
+                || result == Solver::MemoryLimitReached
+                || result == Solver::TimeLimitReached )
+              && !bestMoves.isEmpty() )
+    {
+        m_bestMove = m_solver->translateMove( bestMoves.first() );
+        if ( m_bestMove.isValid() )
+            bestLine = bestMoves.size();
+    }
 
-    emit solverStateChanged( solverStatusMessage( result, m_dealWasEverWinnable ) );
+    emit solverStateChanged( solverStatusMessage( result, m_dealWasEverWinnable, bestLine ) );
 
     if ( m_currentState )
     {
@@ -1524,6 +1841,39 @@ void DealerScene::slotSolverFinished( int result )
 }
 
 
+// The first move of the solution has to be translated while the cards are
+// still where the solver saw them, so the player's next move can be checked
+// against it in takeState().
+void DealerScene::translateNextWinningMove()
+{
+    if ( m_solver && !m_winningMoves.isEmpty() )
+        m_nextWinningMove = m_solver->translateMove( m_winningMoves.first() );
+    else
+        m_nextWinningMove = MoveHint();
+}
+
+
+// A hash of everything the solver gets to see: the cards in every pile and
+// whatever else the game keeps track of.
+quint64 DealerScene::positionFingerprint() const
+{
+    const quint64 prime = Q_UINT64_C(0x100000001B3);
+    quint64 hash = Q_UINT64_C(0xCBF29CE484222325);
+
+    foreach ( const KCardPile * p, piles() )
+    {
+        hash = ( hash ^ p->count() ) * prime;
+        foreach ( const KCard * c, p->cards() )
+            hash = ( hash ^ ( c->suit() << 5 | c->rank() << 1 | c->isFaceUp() ) ) * prime;
+    }
+
+    foreach ( const QChar & ch, getGameState() )
+        hash = ( hash ^ ch.unicode() ) * prime;
+
+    return hash;
+}
+
+
 int DealerScene::gameNumber() const
 {
     return m_dealNumber;
@@ -1606,6 +1956,7 @@ void DealerScene::startDemo()
 
 void DealerScene::stopDemo()
 {
+    m_demoAwaitsSolver = false;
     if ( m_demoInProgress )
     {
         m_demoTimer.stop();
@@ -1636,6 +1987,12 @@ void DealerScene::demo()
 
     m_demoTimer.stop();
 
+    if ( m_winningMoves.isEmpty() && awaitSolverHints() )
+    {
+        m_demoAwaitsSolver = true;
+        return;
+    }
+
     MoveHint mh = chooseHint();
     if ( mh.isValid() )
     {
@@ -1665,8 +2022,8 @@ void DealerScene::demo()
                      << "pile, putting it on top of"
                      << destPile->topCard()->objectName();
         }
-        
-        moveCardsToPile( cards, destPile, DURATION_DEMO );
+
+        moveCardsInDemo( cards, destPile );
     }
     else if ( !newCards() )
     {
@@ -1687,6 +2044,12 @@ void DealerScene::demo()
 }
 
 
+void DealerScene::moveCardsInDemo( const QList<KCard*> & cards, KCardPile * pile )
+{
+    moveCardsToPile( cards, pile, DURATION_DEMO );
+}
+
+
 void DealerScene::drawDealRowOrRedeal()
 {
     stop();
@@ -1713,6 +2076,11 @@ void DealerScene::setSolver( Solver *s) {
     delete m_solverThread;
     m_solver = s;
     m_solverThread = 0;
+    if ( m_solver )
+    {
+        m_solver->setThreadCount( QThread::idealThreadCount() );
+        m_solver->setIncremental( true );
+    }
 }
 
 bool DealerScene::isGameWon() const
@@ -1732,19 +2100,6 @@ void DealerScene::startSolver()
 }
 
 
-bool DealerScene::isGameLost() const
-{
-    if ( solver() )
-    {
-        if ( m_solverThread && m_solverThread->isRunning() )
-            m_solverThread->abort();
-
-        solver()->translate_layout();
-        return solver()->patsolve( neededFutureMoves() ) == Solver::NoSolutionExists;
-    }
-    return false;
-}
-
 void DealerScene::recordGameStatistics()
 {
     // Don't record the game if it was never started, if it is unchanged since
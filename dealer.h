@@ -107,7 +107,6 @@ public:
     Solver * solver() const;
     void startSolver();
 
-    virtual bool isGameLost() const;
     virtual bool isGameWon() const;
 
     bool allowedToStartNewGame();
@@ -171,6 +170,10 @@ protected:
 
     virtual QList<MoveHint> getHints();
 
+    // reimplement this if the solver moves runs of cards at once that
+    // have to go one card at a time, like the supermoves of Freecell
+    virtual void moveCardsInDemo( const QList<KCard*> & cards, KCardPile * pile );
+
     // reimplement these to store and load game-specific information in the state structure
     virtual QString getGameState() const;
     virtual void setGameState( const QString & state );
@@ -205,7 +208,9 @@ protected slots:
 private slots:
     void stopAndRestartSolver();
     void slotSolverEnded();
-    void slotSolverFinished( int result );
+    void slotSolverFinished( int serial, int result, const QList<MOVE> & winMoves, const QList<MOVE> & bestMoves );
+    void slotFirstMovesKnown( int serial );
+    void slotSolverProbed( int serial, int result );
 
     void demo();
 
@@ -222,6 +227,14 @@ private:
 
     int speedUpTime( int delay ) const;
 
+    void applySolverResult( int result, const QList<MOVE> & winMoves, const QList<MOVE> & bestMoves );
+    void translateNextWinningMove();
+    void newSolverPosition();
+    bool awaitSolverHints();
+    void requestSolverHints();
+    void startSolverThread( bool search );
+    quint64 positionFingerprint() const;
+
     void multiStepSubMove( QList<KCard*> cards,
                            KCardPile * pile,
                            QList<KCardPile*> freePiles,
@@ -232,7 +245,13 @@ private:
 
     Solver * m_solver;
     SolverThread * m_solverThread;
+    quint64 m_solverFingerprint;
     QList<MOVE> m_winningMoves;
+    MoveHint m_nextWinningMove;
+    MoveHint m_bestMove;
+    QList<MOVE> m_firstMoves;
+    bool m_firstMovesKnown;
+    int m_stateSerial;
 
     KCard * m_peekedCard;
     MessageBox * m_wonItem;
@@ -276,6 +295,11 @@ private:
     bool m_newCardsQueued;
     bool m_takeStateQueued;
 
+    bool m_hintAwaitsSolver;
+    bool m_demoAwaitsSolver;
+    bool m_dropAwaitsSolver;
+    bool m_searchAwaitsProbe;
+
     QStack<GameState*> m_undoStack;
     GameState * m_currentState;
     QStack<GameState*> m_redoStack;
@@ -115,10 +115,23 @@ void Freecell::restart( const QList<KCard*> & cards )
 
 
 void Freecell::cardsDroppedOnPile( const QList<KCard*> & cards, KCardPile * pile )
+{
+    moveRun( cards, pile, DURATION_MOVE );
+}
+
+
+// The solver moves a run at once, as a supermove.
+void Freecell::moveCardsInDemo( const QList<KCard*> & cards, KCardPile * pile )
+{
+    moveRun( cards, pile, DURATION_DEMO );
+}
+
+
+void Freecell::moveRun( const QList<KCard*> & cards, KCardPile * pile, int duration )
 {
     if ( cards.size() <= 1 )
     {
-        DealerScene::moveCardsToPile( cards, pile, DURATION_MOVE );
+        DealerScene::moveCardsToPile( cards, pile, duration );
         return;
     }
 
@@ -132,7 +145,7 @@ void Freecell::cardsDroppedOnPile( const QList<KCard*> & cards, KCardPile * pile
         if ( store[i]->isEmpty() && store[i] != pile )
             freeStores << store[i];
 
-    multiStepMove( cards, pile, freeStores, freeCells, DURATION_MOVE );
+    multiStepMove( cards, pile, freeStores, freeCells, duration );
 }
 
 
@@ -55,12 +55,14 @@ protected:
     void cardsDroppedOnPile( const QList<KCard*> & cards, KCardPile * pile ) Q_DECL_OVERRIDE;
     void restart( const QList<KCard*> & cards ) Q_DECL_OVERRIDE;
     QList<MoveHint> getHints() Q_DECL_OVERRIDE;
+    void moveCardsInDemo( const QList<KCard*> & cards, KCardPile * pile ) Q_DECL_OVERRIDE;
 
 protected slots:
     bool tryAutomaticMove( KCard * c ) Q_DECL_OVERRIDE;
 
 private:
     bool canPutStore( const KCardPile * pile, const QList<KCard*> & cards ) const;
+    void moveRun( const QList<KCard*> & cards, KCardPile * pile, int duration );
 
     PatPile* store[8];
     PatPile* freecell[4];
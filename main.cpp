@@ -50,8 +50,16 @@
 #include <KLocalizedString>
 #include <KDBusService>
 
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
 #include <QTime>
+#include <QWaitCondition>
 #include <QResizeEvent>
 #include <QDomDocument>
 
@@ -86,6 +94,441 @@ static DealerScene *getDealer( int wanted_game )
     return 0;
 }
 
+static void setupSolver( Solver * solver, const QCommandLineParser & parser )
+{
+    // Every deal is solved once, there is no game to follow.
+    solver->setIncremental( false );
+
+    if ( parser.value( QStringLiteral("store") ) == QLatin1String("tree") )
+        solver->setStoreMode( MemoryManager::TREE_STORE );
+    const QString engine = parser.value( QStringLiteral("engine") );
+    if ( engine == QLatin1String("depth") )
+        solver->setEngine( Solver::DepthFirstEngine );
+    else if ( engine == QLatin1String("auto") )
+        solver->setEngine( Solver::AutomaticEngine );
+    if ( parser.value( QStringLiteral("queues") ) == QLatin1String("best") )
+        solver->setQueuePolicy( Solver::BestFirstQueues );
+    if ( parser.isSet( QStringLiteral("threads") ) )
+        solver->setThreadCount( parser.value( QStringLiteral("threads") ).toInt() );
+    if ( parser.isSet( QStringLiteral("checkpoint") ) )
+        solver->setCheckpointInterval( parser.value( QStringLiteral("checkpoint") ).toInt() );
+    if ( parser.isSet( QStringLiteral("timelimit") ) )
+        solver->setTimeLimit( parser.value( QStringLiteral("timelimit") ).toInt() );
+    solver->setTiming( parser.isSet( QStringLiteral("timing") ) );
+}
+
+class BatchJob;
+
+// The jobs of a batch that are done with their deal.
+struct BatchQueue
+{
+    QMutex mutex;
+    QWaitCondition finished;
+    QList<BatchJob*> done;
+};
+
+// Solves one deal after another with a scene and solver of its own. The
+// scenes belong to the main thread, so the deals are dealt there, and only
+// the search runs in the thread of the job.
+class BatchJob : public QThread
+{
+public:
+    BatchJob( DealerScene * dealer, BatchQueue * queue )
+      : dealer( dealer ),
+        deal( -1 ),
+        result( Solver::UnableToDetermineSolvability ),
+        elapsed( 0 ),
+        m_queue( queue )
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QElapsedTimer timer;
+        timer.start();
+        result = dealer->solver()->patsolve();
+        elapsed = timer.elapsed();
+
+        QMutexLocker lock( &m_queue->mutex );
+        m_queue->done << this;
+        m_queue->finished.wakeOne();
+    }
+
+    DealerScene * const dealer;
+    int deal;
+    int result;
+    qint64 elapsed;
+
+private:
+    BatchQueue * const m_queue;
+};
+
+enum BatchFormat
+{
+    TextFormat,
+    JsonFormat,
+    CsvFormat
+};
+
+static QByteArray batchLine( BatchFormat format, const BatchJob * job )
+{
+    const Solver * s = job->dealer->solver();
+    const QString result = job->result == Solver::SolutionExists ? QStringLiteral("won")
+                         : job->result == Solver::NoSolutionExists ? QStringLiteral("lost")
+                         : QStringLiteral("unknown");
+    const int moves = job->result == Solver::SolutionExists ? s->winMoves.count() : 0;
+
+    QString line;
+    if ( format == JsonFormat )
+    {
+        line = QStringLiteral("{\"deal\":%1,\"result\":\"%2\",\"positions\":%3,\"ms\":%4,\"moves\":%5}\n")
+               .arg( job->deal ).arg( result ).arg( s->generatedPositions() ).arg( job->elapsed ).arg( moves );
+    }
+    else if ( format == CsvFormat )
+    {
+        line = QStringLiteral("%1,%2,%3,%4,%5\n")
+               .arg( job->deal ).arg( result ).arg( s->generatedPositions() ).arg( job->elapsed ).arg( moves );
+    }
+    else
+    {
+        unsigned long positions = s->storedPositions();
+        double bytes = positions ? double( s->usedMemory() ) / positions : 0;
+        line = QStringLiteral("%1 %2 (%3 ms, %4 positions, %5 bytes/position)\n")
+               .arg( job->deal ).arg( result ).arg( job->elapsed ).arg( positions ).arg( bytes, 0, 'f', 1 );
+    }
+    return line.toLatin1();
+}
+
+// The deals an interrupted batch has written out already. A line that was
+// cut short is dropped from the file.
+static QSet<int> finishedDeals( QFile & file, BatchFormat format )
+{
+    QSet<int> deals;
+    const QByteArray data = file.readAll();
+    const int end = data.lastIndexOf( '\n' ) + 1;
+    file.resize( end );
+    file.seek( end );
+
+    foreach ( QByteArray line, data.left( end ).split( '\n' ) )
+    {
+        if ( format == JsonFormat )
+            line = line.mid( line.indexOf( ':' ) + 1 );
+        int len = 0;
+        while ( len < line.size() && line.at( len ) >= '0' && line.at( len ) <= '9' )
+            ++len;
+        bool ok = false;
+        const int deal = line.left( len ).toInt( &ok );
+        if ( ok )
+            deals << deal;
+    }
+    return deals;
+}
+
+// Solve the deals from start to end, as many at a time as there are jobs.
+static int solveDeals( int wanted_game, int start_index, int end_index, const QCommandLineParser & parser )
+{
+    BatchFormat format = TextFormat;
+    if ( parser.value( QStringLiteral("format") ) == QLatin1String("json") )
+        format = JsonFormat;
+    else if ( parser.value( QStringLiteral("format") ) == QLatin1String("csv") )
+        format = CsvFormat;
+
+    QFile out;
+    QSet<int> skipped;
+    if ( parser.isSet( QStringLiteral("output") ) )
+    {
+        const bool resume = parser.isSet( QStringLiteral("resume") );
+        out.setFileName( parser.value( QStringLiteral("output") ) );
+        if ( !out.open( resume ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Truncate ) )
+        {
+            qCritical() << "Cannot write to" << out.fileName();
+            return 1;
+        }
+        if ( resume )
+            skipped = finishedDeals( out, format );
+    }
+    else
+    {
+        out.open( stdout, QIODevice::WriteOnly );
+    }
+    if ( format == CsvFormat && out.pos() == 0 )
+        out.write( "deal,result,positions,ms,moves\n" );
+
+    size_t spill = 0;
+    if ( parser.isSet( QStringLiteral("spill") ) )
+    {
+        size_t cap = parser.isSet( QStringLiteral("spillcap") ) ? parser.value( QStringLiteral("spillcap") ).toULongLong() : 4096;
+        spill = cap * 1024 * 1024;
+        MemoryManager::set_spill( parser.value( QStringLiteral("spill") ), spill );
+    }
+
+    // Every job may take the memory a single one would have, so a deal
+    // comes out the same with any number of jobs. They share the spill
+    // file, though.
+    const int jobs = parser.isSet( QStringLiteral("jobs") ) ? qMax( 1, parser.value( QStringLiteral("jobs") ).toInt() ) : 1;
+    const size_t job_memory = MemoryManager::limit() + spill / jobs;
+    if ( jobs > 1 )
+        MemoryManager::set_limit( jobs * MemoryManager::limit() );
+    BatchQueue queue;
+    QList<BatchJob*> idle;
+    for ( int i = 0; i < jobs; ++i )
+    {
+        DealerScene *f = getDealer( wanted_game );
+        if ( !f )
+            return 1;
+        setupSolver( f->solver(), parser );
+        // The jobs keep the processors busy already.
+        if ( jobs > 1 && !parser.isSet( QStringLiteral("threads") ) )
+            f->solver()->setThreadCount( 1 );
+        if ( jobs > 1 )
+            f->solver()->setMemoryLimit( job_memory );
+        idle << new BatchJob( f, &queue );
+    }
+    const QList<BatchJob*> all = idle;
+
+    qint64 total_ms = 0;
+    quint64 total_generated = 0;
+    quint64 total_positions = 0;
+    quint64 total_memory = 0;
+    qint64 next = start_index;
+    int running = 0;
+    for ( ;; )
+    {
+        while ( !idle.isEmpty() && next <= end_index )
+        {
+            if ( skipped.contains( next ) )
+            {
+                ++next;
+                continue;
+            }
+            BatchJob * job = idle.takeFirst();
+            job->dealer->deck()->stopAnimations();
+            job->dealer->startNew( next );
+            job->dealer->solver()->translate_layout();
+            job->deal = next++;
+            job->start();
+            ++running;
+        }
+        if ( !running )
+            break;
+
+        BatchJob * job;
+        {
+            QMutexLocker lock( &queue.mutex );
+            while ( queue.done.isEmpty() )
+                queue.finished.wait( &queue.mutex );
+            job = queue.done.takeFirst();
+        }
+        job->wait();
+        --running;
+
+        // Written at once, so an interrupted batch can go on from here.
+        out.write( batchLine( format, job ) );
+        out.flush();
+
+        const Solver * s = job->dealer->solver();
+        total_ms += job->elapsed;
+        total_generated += s->generatedPositions();
+        total_positions += s->storedPositions();
+        total_memory += s->usedMemory();
+        idle << job;
+    }
+    qDeleteAll( all );
+
+    if ( format == TextFormat )
+    {
+        fprintf( stdout, "all_moves %ld\n", all_moves.load() );
+        if ( total_positions )
+            fprintf( stdout, "%.0f positions/s, %.1f bytes/position\n",
+                     total_ms ? total_generated * 1000.0 / total_ms : 0.0,
+                     double( total_memory ) / total_positions );
+    }
+    return 0;
+}
+
+typedef QPair<int, QList<int> > CorpusGame;
+
+// A corpus of the solver benchmark has a game id as for --solve on every
+// line, followed by deal numbers and ranges of them like 10-20. Anything
+// after a # is a comment.
+static bool readCorpus( const QString & fileName, QList<CorpusGame> * corpus )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return false;
+
+    while ( !file.atEnd() )
+    {
+        QByteArray line = file.readLine();
+        line.truncate( line.indexOf( '#' ) == -1 ? line.size() : line.indexOf( '#' ) );
+        const QList<QByteArray> fields = line.simplified().split( ' ' );
+        if ( fields.first().isEmpty() )
+            continue;
+
+        bool ok;
+        CorpusGame game;
+        game.first = fields.first().toInt( &ok );
+        if ( !ok )
+            return false;
+        for ( int i = 1; i < fields.size(); ++i )
+        {
+            const QList<QByteArray> range = fields.at( i ).split( '-' );
+            const int first = range.first().toInt( &ok );
+            const int last = ok ? range.last().toInt( &ok ) : 0;
+            if ( !ok || range.size() > 2 || last < first )
+                return false;
+            for ( int deal = first; deal <= last; ++deal )
+                game.second << deal;
+        }
+        *corpus << game;
+    }
+    return true;
+}
+
+// Solve every deal of a corpus with one thread and print a line per deal,
+// which is what --baseline reads back. If it is given, a summary on stderr
+// compares every game with it, and a game that got slower than the
+// threshold or a deal that is decided otherwise than before fails the run.
+static int runBenchmark( const QCommandLineParser & parser )
+{
+    QList<CorpusGame> corpus;
+    if ( !readCorpus( parser.value( QStringLiteral("benchmark") ), &corpus ) )
+    {
+        qCritical() << "Cannot read the deals from" << parser.value( QStringLiteral("benchmark") );
+        return 1;
+    }
+
+    QHash<QPair<int,int>, QJsonObject> baseline;
+    if ( parser.isSet( QStringLiteral("baseline") ) )
+    {
+        QFile file( parser.value( QStringLiteral("baseline") ) );
+        if ( !file.open( QIODevice::ReadOnly ) )
+        {
+            qCritical() << "Cannot read" << file.fileName();
+            return 1;
+        }
+        while ( !file.atEnd() )
+        {
+            const QJsonObject o = QJsonDocument::fromJson( file.readLine() ).object();
+            baseline.insert( qMakePair( o.value( QStringLiteral("game") ).toInt(), o.value( QStringLiteral("deal") ).toInt() ), o );
+        }
+    }
+    const int threshold = parser.isSet( QStringLiteral("threshold") ) ? parser.value( QStringLiteral("threshold") ).toInt() : 10;
+
+    QFile out;
+    if ( parser.isSet( QStringLiteral("output") ) )
+    {
+        out.setFileName( parser.value( QStringLiteral("output") ) );
+        if ( !out.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        {
+            qCritical() << "Cannot write to" << out.fileName();
+            return 1;
+        }
+    }
+    else
+    {
+        out.open( stdout, QIODevice::WriteOnly );
+    }
+
+    bool regressed = false;
+    foreach ( const CorpusGame & game, corpus )
+    {
+        DealerScene *f = getDealer( game.first );
+        if ( !f )
+            return 1;
+        setupSolver( f->solver(), parser );
+        if ( !parser.isSet( QStringLiteral("threads") ) )
+            f->solver()->setThreadCount( 1 );
+
+        qint64 ms = 0;
+        qint64 decided_ms = 0;
+        quint64 generated = 0;
+        quint64 peak_memory = 0;
+        int decided = 0;
+        int changed = 0;
+        qint64 base_ms = 0;
+        double base_generated = 0;
+        foreach ( int deal, game.second )
+        {
+            f->deck()->stopAnimations();
+            f->startNew( deal );
+            f->solver()->translate_layout();
+            QElapsedTimer timer;
+            timer.start();
+            const int ret = f->solver()->patsolve();
+            const qint64 elapsed = timer.elapsed();
+            const Solver * s = f->solver();
+
+            const QString result = ret == Solver::SolutionExists ? QStringLiteral("won")
+                                 : ret == Solver::NoSolutionExists ? QStringLiteral("lost")
+                                 : QStringLiteral("unknown");
+            QJsonObject line;
+            line.insert( QStringLiteral("game"), game.first );
+            line.insert( QStringLiteral("deal"), deal );
+            line.insert( QStringLiteral("result"), result );
+            line.insert( QStringLiteral("positions"), double( s->generatedPositions() ) );
+            line.insert( QStringLiteral("ms"), double( elapsed ) );
+            line.insert( QStringLiteral("memory"), double( s->usedMemory() ) );
+            line.insert( QStringLiteral("moves"), ret == Solver::SolutionExists ? s->winMoves.count() : 0 );
+            const SOLVERSTATS stats = s->statistics();
+            line.insert( QStringLiteral("duplicates"), double( stats.duplicates ) );
+            line.insert( QStringLiteral("expanded"), double( stats.expanded ) );
+            line.insert( QStringLiteral("best_outs"), double( stats.bestouts ) );
+            line.insert( QStringLiteral("dequeued"), double( stats.dequeued ) );
+            line.insert( QStringLiteral("queue_scans"), double( stats.qscans ) );
+            if ( parser.isSet( QStringLiteral("timing") ) )
+            {
+                line.insert( QStringLiteral("movegen_ms"), stats.movegen_ns / 1e6 );
+                line.insert( QStringLiteral("makemove_ms"), stats.makemove_ns / 1e6 );
+                line.insert( QStringLiteral("insert_ms"), stats.insert_ns / 1e6 );
+                line.insert( QStringLiteral("queue_ms"), stats.queue_ns / 1e6 );
+            }
+            out.write( QJsonDocument( line ).toJson( QJsonDocument::Compact ) + '\n' );
+            out.flush();
+
+            ms += elapsed;
+            generated += s->generatedPositions();
+            peak_memory = qMax<quint64>( peak_memory, s->usedMemory() );
+            if ( ret == Solver::SolutionExists || ret == Solver::NoSolutionExists )
+            {
+                ++decided;
+                decided_ms += elapsed;
+            }
+
+            const QJsonObject old = baseline.value( qMakePair( game.first, deal ) );
+            if ( !old.isEmpty() )
+            {
+                base_ms += old.value( QStringLiteral("ms") ).toDouble();
+                base_generated += old.value( QStringLiteral("positions") ).toDouble();
+                // A search that failed before may get somewhere now, but
+                // a verdict must not change.
+                const QString was = old.value( QStringLiteral("result") ).toString();
+                if ( was != result && was != QLatin1String("unknown") )
+                    ++changed;
+            }
+        }
+
+        const double rate = ms ? generated * 1000.0 / ms : 0.0;
+        fprintf( stderr, "game %d: %d deals, %d decided in %lld ms on average, %.0f positions/s, peak %llu bytes",
+                 game.first, game.second.size(), decided, ( long long )( decided ? decided_ms / decided : 0 ),
+                 rate, ( unsigned long long )peak_memory );
+        if ( !baseline.isEmpty() )
+        {
+            const double base_rate = base_ms ? base_generated * 1000.0 / base_ms : 0.0;
+            const double gain = base_rate ? ( rate / base_rate - 1 ) * 100 : 0.0;
+            fprintf( stderr, ", %+.1f%% positions/s, %d verdicts changed", gain, changed );
+            if ( changed || gain < -threshold )
+            {
+                fprintf( stderr, " REGRESSED" );
+                regressed = true;
+            }
+        }
+        fprintf( stderr, "\n" );
+    }
+
+    return regressed ? 1 : 0;
+}
+
 // A function to remove all nonalphanumeric characters from a string
 // and convert all letters to lowercase.
 QString lowerAlphaNum( const QString & string )
@@ -192,6 +635,22 @@ int main( int argc, char **argv )
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("solve"), i18n("Dealer to solve (debug)" ), QStringLiteral("num")));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("start"), i18n("Game range start (default 0:INT_MAX)" ), QStringLiteral("num")));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("end"), i18n("Game range end (default start:start if start given)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("store"), i18n("Position store of the solver: tree or hash (debug)" ), QStringLiteral("store")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("engine"), i18n("Search of the solver: best, depth or auto, which goes on depth first when best first runs out (debug)" ), QStringLiteral("engine")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("queues"), i18n("Order the best-first search takes positions in: roundrobin or best (debug)" ), QStringLiteral("policy")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("threads"), i18n("Number of threads the solver searches with (debug)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("checkpoint"), i18n("Keep the layout of every num-th position only and replay the moves to the others. The solver can then find wins, but not tell that a deal is lost (debug)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("timelimit"), i18n("Give up on a deal after this many milliseconds (debug)" ), QStringLiteral("ms")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("spill"), i18n("Directory the solver goes on in when it runs out of memory (debug)" ), QStringLiteral("directory")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("spillcap"), i18n("Disk space the solver may use in the spill directory, in MB, shared by the jobs (default 4096)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("jobs"), i18n("Number of deals to solve at the same time, each in a thread of its own (default 1)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("format"), i18n("Print one line per solved deal as text, json or csv (default text)" ), QStringLiteral("format")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("output"), i18n("File to write the results of the solved deals to" ), QStringLiteral("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("resume"), i18n("Skip the deals that are in the output file already and add the others to it" )));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("benchmark"), i18n("Solve the deals listed in file and print the numbers of the solver (debug)" ), QStringLiteral("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("baseline"), i18n("Compare the benchmark with the output of an earlier one" ), QStringLiteral("file")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("threshold"), i18n("Fail the benchmark if a game gets slower than the baseline by more than this, in percent (default 10)" ), QStringLiteral("num")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("timing"), i18n("Take the time every phase of the solver takes, which slows it down (debug)" )));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("gametype"), i18n("Skip the selection screen and load a particular game type. Valid values are: %1",gameList.join(listSeparator)), QStringLiteral("game")));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("testdir"), i18n( "Directory with test cases" ), QStringLiteral("directory")));
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("generate"), i18n( "Generate random test cases" )));
@@ -264,6 +723,9 @@ int main( int argc, char **argv )
        return 0;
     }
 
+    if ( parser.isSet( QStringLiteral("benchmark") ) )
+        return runBenchmark( parser );
+
     bool ok = false;
     int wanted_game = -1;
     if ( parser.isSet( QStringLiteral("solve") ) )
@@ -287,27 +749,7 @@ int main( int argc, char **argv )
             if ( end_index == -1 )
                 end_index = start_index;
         }
-        DealerScene *f = getDealer( wanted_game );
-        if ( !f )
-            return 1;
-
-        QTime mytime;
-        for ( int i = start_index; i <= end_index; i++ )
-        {
-            mytime.start();
-            f->deck()->stopAnimations();
-            f->startNew( i );
-            f->solver()->translate_layout();
-            int ret = f->solver()->patsolve();
-            if ( ret == Solver::SolutionExists )
-                fprintf( stdout, "%d won (%d ms)\n", i, mytime.elapsed() );
-            else if ( ret == Solver::NoSolutionExists )
-                fprintf( stdout, "%d lost (%d ms)\n", i, mytime.elapsed()  );
-            else
-                fprintf( stdout, "%d unknown (%d ms)\n", i, mytime.elapsed() );
-        }
-        fprintf( stdout, "all_moves %ld\n", all_moves );
-        return 0;
+        return solveDeals( wanted_game, start_index, end_index, parser );
     }
 
     QString gametype = parser.value(QStringLiteral("gametype")).toLower();
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARDSET_H
+#define CARDSET_H
+
+#include <QtCore/QtGlobal>
+
+/* A set of cards, one bit for every card.  The bit of a card is its suit
+and rank, (suit << 4) + rank, so every suit has 16 bits of its own, of
+which 1 to 13 are used.  Whether the card is face down doesn't matter,
+and with two decks the set has the cards that are there at least once.
+Moves can then be looked for in all piles at once: the cards that fit on
+the top cards, or that can go out next, are a few shifts and masks away. */
+
+typedef quint64 cardset_t;
+
+#define CARDSET_SUIT   Q_UINT64_C(0x000000000000FFFF)   /* the bits of diamonds */
+#define CARDSET_RED    Q_UINT64_C(0x0000FFFF0000FFFF)   /* diamonds and hearts */
+#define CARDSET_BLACK  Q_UINT64_C(0xFFFF0000FFFF0000)   /* clubs and spades */
+
+static inline cardset_t card_bit(quint8 card)
+{
+	return (cardset_t)1 << (card & 0x3F);
+}
+
+/* The ranks in the set, whatever the suit, as a set of diamonds. */
+
+static inline cardset_t set_ranks(cardset_t s)
+{
+	s |= s >> 32;
+	s |= s >> 16;
+	return s & CARDSET_SUIT;
+}
+
+/* The cards of these ranks (a set of diamonds) in the suits of mask. */
+
+static inline cardset_t set_spread(cardset_t ranks, cardset_t mask)
+{
+	return (ranks * Q_UINT64_C(0x0001000100010001)) & mask;
+}
+
+/* The cards of this rank in every suit. */
+
+static inline cardset_t set_of_rank(int rank)
+{
+	return Q_UINT64_C(0x0001000100010001) << rank;
+}
+
+/* The cards one rank below those in the set, in the same suit. */
+
+static inline cardset_t set_below(cardset_t s)
+{
+	return s >> 1;
+}
+
+/* The cards of the other color one rank below those in the set, that is
+the ones that can be put on them when the colors have to alternate. */
+
+static inline cardset_t set_fits_alternate(cardset_t s)
+{
+	return set_spread(set_ranks(set_below(s & CARDSET_RED)), CARDSET_BLACK) |
+	       set_spread(set_ranks(set_below(s & CARDSET_BLACK)), CARDSET_RED);
+}
+
+static inline int set_count(cardset_t s)
+{
+	s = s - ((s >> 1) & Q_UINT64_C(0x5555555555555555));
+	s = (s & Q_UINT64_C(0x3333333333333333)) + ((s >> 2) & Q_UINT64_C(0x3333333333333333));
+	s = (s + (s >> 4)) & Q_UINT64_C(0x0F0F0F0F0F0F0F0F);
+	return (int)((s * Q_UINT64_C(0x0101010101010101)) >> 56);
+}
+
+#endif // CARDSET_H
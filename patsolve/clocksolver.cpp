@@ -230,7 +230,7 @@ int ClockSolver::getOuts()
 }
 
 ClockSolver::ClockSolver(const Clock *dealer)
-    : Solver()
+    : SolverCore<ClockSolver>()
 {
     setNumberPiles( 9 );
     deal = dealer;
@@ -299,3 +299,5 @@ void ClockSolver::print_layout()
     }
     fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<ClockSolver>;
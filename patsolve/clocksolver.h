@@ -19,10 +19,10 @@
 #define CLOCKSOLVER_H
 
 class Clock;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class ClockSolver : public Solver
+class ClockSolver : public SolverCore<ClockSolver>
 {
 public:
     explicit ClockSolver(const Clock *dealer);
@@ -33,6 +33,7 @@ public:
     int getOuts() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new ClockSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
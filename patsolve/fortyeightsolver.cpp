@@ -546,7 +546,7 @@ int FortyeightSolver::getOuts()
 }
 
 FortyeightSolver::FortyeightSolver(const Fortyeight *dealer)
-    : Solver()
+    : SolverCore<FortyeightSolver>()
 {
     setNumberPiles( 10 );
     deal = dealer;
@@ -684,3 +684,5 @@ void FortyeightSolver::print_layout()
 #endif
     fprintf(stderr, "print-layout-end\n");
 }
+
+template class SolverCore<FortyeightSolver>;
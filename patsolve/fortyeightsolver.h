@@ -19,11 +19,11 @@
 #define FORTYEIGHTSOLVER_H
 
 class Fortyeight;
-#include "patsolve.h"
+#include "solvercore.h"
 
 class FortyeightSolverState;
 
-class FortyeightSolver : public Solver
+class FortyeightSolver : public SolverCore<FortyeightSolver>
 {
 public:
     explicit FortyeightSolver(const Fortyeight *dealer);
@@ -37,6 +37,7 @@ public:
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new FortyeightSolver( *this ); }
     bool checkMove( int from, int to, MOVE *mp );
     bool checkMoveOut( int from, MOVE *mp, int *dropped );
     void checkState(FortyeightSolverState &d);
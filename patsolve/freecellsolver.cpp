@@ -32,55 +32,60 @@
 
 int FreecellSolver::Xparam[] = { 4, 1, 8, -1, 7, 11, 4, 2, 2, 1, 2 };
 
-/* These two routines make and unmake moves. */
+/* These two routines make and unmake moves.  A move between W piles
+takes the card at card_index along with the ones above it (a supermove,
+which the dealer plays one card at a time through the free cells and empty
+piles). */
 
 void FreecellSolver::make_move(MOVE *m)
 {
-	int from, to;
-	card_t card;
+	int i, from, to;
 
 	from = m->from;
 	to = m->to;
 
-	/* Remove from pile. */
-
-        card = *Wp[from]--;
-        Wlen[from]--;
-        hashpile(from);
-
-	/* Add to pile. */
+	/* Remove from pile, and add to 'to' pile. */
 
 	if (m->totype == O_Type) {
+            Wp[from]--;
+            Wlen[from]--;
             O[to]++;
         } else {
-            *++Wp[to] = card;
-            Wlen[to]++;
+            for (i = m->card_index; i >= 0; --i) {
+                *++Wp[to] = Wp[from][-i];
+            }
+            Wp[from] -= m->card_index + 1;
+            Wlen[from] -= m->card_index + 1;
+            Wlen[to] += m->card_index + 1;
             hashpile(to);
 	}
+        hashpile(from);
 }
 
 void FreecellSolver::undo_move(MOVE *m)
 {
-	int from, to;
+	int i, from, to;
 	card_t card;
 
 	from = m->from;
 	to = m->to;
 
-	/* Remove from 'to' pile. */
+	/* Remove from 'to' pile, and add to 'from' pile. */
 
 	if (m->totype == O_Type) {
             card = O[to] + Osuit[to];
             O[to]--;
+            *++Wp[from] = card;
+            Wlen[from]++;
         } else {
-            card = *Wp[to]--;
-            Wlen[to]--;
+            for (i = m->card_index; i >= 0; --i) {
+                *++Wp[from] = Wp[to][-i];
+            }
+            Wp[to] -= m->card_index + 1;
+            Wlen[to] -= m->card_index + 1;
+            Wlen[from] += m->card_index + 1;
             hashpile(to);
 	}
-
-	/* Add to 'from' pile. */
-        *++Wp[from] = card;
-        Wlen[from]++;
         hashpile(from);
 }
 
@@ -89,87 +94,44 @@ that are a waste of time, especially in the endgame where there are lots of
 possible moves, but few productive ones.  Note that we also prioritize
 positions when they are added to the queue. */
 
-#define NNEED 8
-
 void FreecellSolver::prioritize(MOVE *mp0, int n)
 {
-	int i, j, s, w, pile[NNEED], npile;
-	card_t card, need[4];
+	int i, s, w;
+	cardset_t need, want;
 	MOVE *mp;
 
 	/* There are 4 cards that we "need": the next cards to go out.  We
 	give higher priority to the moves that remove cards from the piles
 	containing these cards. */
 
-	for (i = 0; i < NNEED; ++i) {
-		pile[i] = -1;
-	}
-	npile = 0;
-
+	need = want = 0;
 	for (s = 0; s < 4; ++s) {
-		need[s] = NONE;
-		if (O[s] == NONE) {
-			need[s] = Osuit[s] + PS_ACE;
-		} else if (O[s] != PS_KING) {
-			need[s] = Osuit[s] + O[s] + 1;
-		}
-	}
-
-	/* Locate the needed cards.  There's room for optimization here,
-	like maybe an array that keeps track of every card; if maintaining
-	such an array is not too expensive. */
-
-	for (w = 0; w < Nwpiles; ++w) {
-		j = Wlen[w];
-		for (i = 0; i < j; ++i) {
-			card = W[w][i];
-			s = SUIT(card);
-
-			/* Save the locations of the piles containing
-			not only the card we need next, but the card
-			after that as well. */
-
-			if (need[s] != NONE &&
-			    (card == need[s] || card == need[s] + 1)) {
-				pile[npile++] = w;
-				if (npile == NNEED) {
-					break;
-				}
-			}
-		}
-		if (npile == NNEED) {
-			break;
+		if (O[s] != PS_KING) {
+			need |= card_bit(Osuit[s] + O[s] + 1);
+			want |= card_bit(Osuit[s] + O[s] + 2);
 		}
 	}
 
-	/* Now if any of the moves remove a card from any of the piles
-	listed in pile[], bump their priority.  Likewise, if a move
-	covers a card we need, decrease its priority.  These priority
-	increments and decrements were determined empirically. */
+	/* We want not only the cards we need next, but the cards after
+	those as well.  Now if any of the moves remove a card from a W
+	pile with such cards, bump their priority, once for every card.
+	Likewise, if a move covers a card we need, decrease its priority.
+	These priority increments and decrements were determined
+	empirically. */
 
+	want |= need;
 	for (i = 0, mp = mp0; i < n; ++i, ++mp) {
 		if (mp->card_index != -1) {
 			w = mp->from;
-			for (j = 0; j < npile; ++j) {
-				if (w == pile[j]) {
-					mp->pri += Xparam[0];
-				}
+			if (w < Nwpiles) {
+				mp->pri += Xparam[0] * set_count(Wset[w] & want);
 			}
-			if (Wlen[w] > 1) {
-				card = W[w][Wlen[w] - 2];
-				for (s = 0; s < 4; ++s) {
-					if (card == need[s]) {
-						mp->pri += Xparam[1];
-						break;
-					}
-				}
+			if (Wlen[w] > mp->card_index + 1 &&
+			    (card_bit(W[w][Wlen[w] - mp->card_index - 2]) & need)) {
+				mp->pri += Xparam[1];
 			}
-			if (mp->totype == W_Type) {
-				for (j = 0; j < npile; ++j) {
-					if (mp->to == pile[j]) {
-						mp->pri -= Xparam[2];
-					}
-				}
+			if (mp->totype == W_Type && mp->to < Nwpiles) {
+				mp->pri -= Xparam[2] * set_count(Wset[mp->to] & want);
 			}
 		}
 	}
@@ -221,10 +183,28 @@ int FreecellSolver::good_automove(int o, int r)
 
 int FreecellSolver::get_possible_moves(int *a, int *numout)
 {
-	int i, n, t, w, o, empty, emptyw;
+	int i, l, n, t, w, o, emptyw, nemptyw, freet;
 	card_t card;
+	cardset_t tops, out, fits;
 	MOVE *mp;
 
+	/* The cards that can go out, and those that fit on the top cards
+	of the W piles. */
+
+	out = 0;
+	for (o = 0; o < 4; ++o) {
+		if (O[o] != PS_KING) {
+			out |= card_bit(Osuit[o] + O[o] + 1);
+		}
+	}
+	tops = 0;
+	for (w = 0; w < Nwpiles; ++w) {
+		if (Wlen[w] > 0) {
+			tops |= card_bit(*Wp[w]);
+		}
+	}
+	fits = set_fits_alternate(tops);
+
 	/* Check for moves from W to O. */
 
 	n = 0;
@@ -233,9 +213,7 @@ int FreecellSolver::get_possible_moves(int *a, int *numout)
 		if (Wlen[w] > 0) {
 			card = *Wp[w];
 			o = SUIT(card);
-			empty = (O[o] == NONE);
-			if ((empty && (RANK(card) == PS_ACE)) ||
-			    (!empty && (RANK(card) == O[o] + 1))) {
+			if (card_bit(card) & out) {
 				mp->card_index = 0;
 				mp->from = w;
 				mp->to = o;
@@ -265,16 +243,28 @@ int FreecellSolver::get_possible_moves(int *a, int *numout)
 	*a = false;
 	*numout = n;
 
-	/* Check for moves from non-singleton W cells to one of any
-	empty W cells. */
+	/* A run of cards of alternating colors can be moved as a whole
+	through the free cells and empty W piles: with f of the first and
+	e of the second, up to (f + 1) * 2^e cards. */
 
+	freet = 0;
+	for (t = Nwpiles; t < Nwpiles + Ntpiles; ++t) {
+		if (Wlen[t] == 0) {
+			freet++;
+		}
+	}
 	emptyw = -1;
-	for (w = 0; w < Nwpiles; ++w) {
+	nemptyw = 0;
+	for (w = Nwpiles - 1; w >= 0; --w) {
 		if (Wlen[w] == 0) {
 			emptyw = w;
-			break;
+			nemptyw++;
 		}
 	}
+
+	/* Check for moves from non-singleton W cells to one of any
+	empty W cells. */
+
 	if (emptyw >= 0) {
 		for (i = 0; i < Nwpiles + Ntpiles; ++i) {
 			if (i == emptyw || Wlen[i] == 0) {
@@ -305,7 +295,7 @@ int FreecellSolver::get_possible_moves(int *a, int *numout)
 	/* Check for moves from W to non-empty W cells. */
 
 	for (i = 0; i < Nwpiles + Ntpiles; ++i) {
-		if (Wlen[i] > 0) {
+		if (Wlen[i] > 0 && (card_bit(*Wp[i]) & fits)) {
 			card = *Wp[i];
 			for (w = 0; w < Nwpiles; ++w) {
 				if (i == w) {
@@ -330,6 +320,49 @@ int FreecellSolver::get_possible_moves(int *a, int *numout)
 		}
 	}
 
+	/* Check for supermoves, runs of more than one card, from W to the
+	first empty W pile or to the W piles the bottom card of the run fits
+	on.  Moving a whole pile to an empty one gets us nowhere. */
+
+	for (i = 0; i < Nwpiles; ++i) {
+		for (l = 1; l < Wlen[i]; ++l) {
+			card = Wp[i][-l];
+			if (RANK(card) != RANK(Wp[i][1 - l]) + 1 ||
+			    !suitable(card, Wp[i][1 - l]) ||
+			    l + 1 > (freet + 1) << nemptyw) {
+				break;
+			}
+			if (emptyw >= 0 && l + 1 < Wlen[i] &&
+			    l + 1 <= (freet + 1) << (nemptyw - 1)) {
+				mp->card_index = l;
+				mp->from = i;
+				mp->to = emptyw;
+				mp->totype = W_Type;
+				mp->turn_index = -1;
+				mp->pri = Xparam[3];
+				n++;
+				mp++;
+			}
+			if (!(card_bit(card) & fits)) {
+				continue;
+			}
+			for (w = 0; w < Nwpiles; ++w) {
+				if (i != w && Wlen[w] > 0 &&
+				    RANK(card) == RANK(*Wp[w]) - 1 &&
+				    suitable(card, *Wp[w])) {
+					mp->card_index = l;
+					mp->from = i;
+					mp->to = w;
+					mp->totype = W_Type;
+					mp->turn_index = -1;
+					mp->pri = Xparam[4];
+					n++;
+					mp++;
+				}
+			}
+		}
+	}
+
         /* Check for moves from W to one of any empty T cells. */
 
         for (t = 0; t < Ntpiles; ++t) {
@@ -388,7 +421,7 @@ int FreecellSolver::getOuts()
 }
 
 FreecellSolver::FreecellSolver(const Freecell *dealer)
-    : Solver()
+    : SolverCore<FreecellSolver>()
 {
     Osuit[0] = PS_DIAMOND;
     Osuit[1] = PS_CLUB;
@@ -448,7 +481,8 @@ void FreecellSolver::translate_layout()
 
 MoveHint FreecellSolver::translateMove( const MOVE &m )
 {
-    // this is tricky as we need to want to build the "meta moves"
+    // a supermove is hinted by the bottom card of the run, the dealer
+    // breaks it up into single card moves (see Freecell::cardsDroppedOnPile)
 
     PatPile *frompile = 0;
     if ( m.from < 8 )
@@ -495,6 +529,16 @@ unsigned int FreecellSolver::getClusterNumber()
     return k;
 }
 
+/* The Out cell of suit s becomes that of perm[s]. */
+
+unsigned int FreecellSolver::suit_cluster( unsigned int k, const int *perm )
+{
+    unsigned int n = 0;
+    for ( int o = 0; o < 4; ++o )
+        n |= ( ( k >> ( o * 4 ) ) & 0xF ) << ( perm[o] * 4 );
+    return n;
+}
+
 void FreecellSolver::print_layout()
 {
        int i, t, w, o;
@@ -517,3 +561,5 @@ void FreecellSolver::print_layout()
        }
        fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<FreecellSolver>;
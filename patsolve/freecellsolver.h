@@ -20,10 +20,10 @@
 #define FREECELLSOLVER_H
 
 class Freecell;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class FreecellSolver : public Solver
+class FreecellSolver : public SolverCore<FreecellSolver>
 {
 public:
     explicit FreecellSolver(const Freecell *dealer);
@@ -37,7 +37,9 @@ public:
     unsigned int getClusterNumber() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
+    unsigned int suit_cluster( unsigned int k, const int *perm ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new FreecellSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frontier.h"
+
+#include "patsolve.h"
+
+
+RoundRobinFrontier::RoundRobinFrontier()
+{
+	clear();
+}
+
+void RoundRobinFrontier::clear(void)
+{
+	int i;
+
+	for (i = 0; i < NQUEUES; ++i) {
+		Qhead[i] = NULL;
+	}
+	Maxq = 0;
+	Qpos = Qminpos = 0;
+}
+
+void RoundRobinFrontier::push(POSITION *pos, int pri)
+{
+	if (pri > Maxq) {
+		Maxq = pri;
+	}
+
+	/* We always dequeue from the head. */
+
+	pos->queue = Qhead[pri];
+	Qhead[pri] = pos;
+}
+
+POSITION *RoundRobinFrontier::pop(int *pri, int *scans)
+{
+	int last;
+	POSITION *pos;
+	int &qpos = Qpos;
+	int &minpos = Qminpos;
+
+	/* This is a kind of prioritized round robin.  We make sweeps
+	through the queues, starting at the highest priority and
+	working downwards; each time through the sweeps get longer.
+	That way the highest priority queues get serviced the most,
+	but we still get lots of low priority action (instead of
+	ignoring it completely). */
+
+	*scans = 0;
+	last = false;
+	do {
+		++*scans;
+		qpos--;
+		if (qpos < minpos) {
+			if (last) {
+				return NULL;
+			}
+			qpos = Maxq;
+			minpos--;
+			if (minpos < 0) {
+				minpos = Maxq;
+			}
+			if (minpos == 0) {
+				last = true;
+			}
+		}
+	} while (Qhead[qpos] == NULL);
+
+	pos = Qhead[qpos];
+	Qhead[qpos] = pos->queue;
+	*pri = qpos;
+
+	/* Decrease Maxq if that queue emptied. */
+
+	while (Qhead[qpos] == NULL && qpos == Maxq && Maxq > 0) {
+		Maxq--;
+		qpos--;
+		if (qpos < minpos) {
+			minpos = qpos;
+		}
+	}
+
+	return pos;
+}
+
+BucketFrontier::BucketFrontier()
+{
+	clear();
+}
+
+void BucketFrontier::clear(void)
+{
+	int i;
+
+	for (i = 0; i < NQUEUES; ++i) {
+		Qhead[i] = NULL;
+	}
+	for (i = 0; i < (NQUEUES + 63) / 64; ++i) {
+		Used[i] = 0;
+	}
+}
+
+void BucketFrontier::push(POSITION *pos, int pri)
+{
+	pos->queue = Qhead[pri];
+	Qhead[pri] = pos;
+	Used[pri / 64] |= (quint64)1 << (pri % 64);
+}
+
+/* The number of the highest bit set in a non zero word. */
+
+static int highest_bit(quint64 x)
+{
+	int n = 0;
+
+	if (x >> 32) {
+		n += 32;
+		x >>= 32;
+	}
+	if (x >> 16) {
+		n += 16;
+		x >>= 16;
+	}
+	if (x >> 8) {
+		n += 8;
+		x >>= 8;
+	}
+	if (x >> 4) {
+		n += 4;
+		x >>= 4;
+	}
+	if (x >> 2) {
+		n += 2;
+		x >>= 2;
+	}
+	return n + (int)(x >> 1);
+}
+
+POSITION *BucketFrontier::pop(int *pri, int *scans)
+{
+	int i, q;
+	POSITION *pos;
+
+	*scans = 0;
+	for (i = (NQUEUES + 63) / 64 - 1; i >= 0; --i) {
+		++*scans;
+		if (Used[i]) {
+			break;
+		}
+	}
+	if (i < 0) {
+		return NULL;
+	}
+
+	q = i * 64 + highest_bit(Used[i]);
+	pos = Qhead[q];
+	Qhead[q] = pos->queue;
+	if (Qhead[q] == NULL) {
+		Used[i] &= ~((quint64)1 << (q % 64));
+	}
+	*pri = q;
+
+	return pos;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+#include <QtCore/QtGlobal>
+
+#define NQUEUES 127
+
+struct POSITION;
+
+/* The positions of a best first search that wait to be expanded.  Each
+has a priority from 0 to NQUEUES - 1, and there is a list of positions
+for every priority, linked through POSITION::queue.  What the policies
+differ in is which list the next position is taken from. */
+
+class Frontier
+{
+public:
+    virtual ~Frontier() {}
+
+    /* Add a position with priority pri. */
+    virtual void push(POSITION *pos, int pri) = 0;
+
+    /* Take the next position off, or return NULL if there is none.  Its
+       priority goes to *pri, and the number of lists (or words of the
+       bitmap) looked at to find it to *scans. */
+    virtual POSITION *pop(int *pri, int *scans) = 0;
+
+    /* Forget all positions. */
+    virtual void clear(void) = 0;
+
+protected:
+    POSITION *Qhead[NQUEUES];   /* a stack for each priority */
+};
+
+/* The prioritized round robin patsolve always had: sweeps through the
+lists, from the highest priority down, that get a little longer every
+time.  High priorities get most of the work, low ones aren't starved. */
+
+class RoundRobinFrontier : public Frontier
+{
+public:
+    RoundRobinFrontier();
+
+    void push(POSITION *pos, int pri) Q_DECL_OVERRIDE;
+    POSITION *pop(int *pri, int *scans) Q_DECL_OVERRIDE;
+    void clear(void) Q_DECL_OVERRIDE;
+
+private:
+    int Maxq;                   /* the highest list in use */
+    int Qpos, Qminpos;          /* where the sweep is */
+};
+
+/* Always the highest priority there is.  A bit for every list that isn't
+empty tells which one that is without looking at the lists. */
+
+class BucketFrontier : public Frontier
+{
+public:
+    BucketFrontier();
+
+    void push(POSITION *pos, int pri) Q_DECL_OVERRIDE;
+    POSITION *pop(int *pri, int *scans) Q_DECL_OVERRIDE;
+    void clear(void) Q_DECL_OVERRIDE;
+
+private:
+    quint64 Used[(NQUEUES + 63) / 64];
+};
+
+#endif // FRONTIER_H
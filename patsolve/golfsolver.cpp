@@ -21,9 +21,39 @@
 
 #include <QDebug>
 
+#include <stdlib.h>
+
 
 #define PRINT 0
 
+/* Playing the top card of column w, and drawing a card from the talon. */
+
+static MOVE column_move( int w, card_t card )
+{
+    MOVE m;
+    m.card_index = 0;
+    m.from = w;
+    m.to = 7;
+    m.totype = W_Type;
+    m.pri = 13;
+    if ( RANK( card ) == PS_ACE || RANK( card ) == PS_KING )
+        m.pri = 30;
+    m.turn_index = -1;
+    return m;
+}
+
+static MOVE talon_move()
+{
+    MOVE m;
+    m.card_index = 1;
+    m.from = 8;
+    m.to = 7;
+    m.totype = W_Type;
+    m.pri = 5;
+    m.turn_index = 0;
+    return m;
+}
+
 void GolfSolver::make_move(MOVE *m)
 {
 #if PRINT
@@ -142,39 +172,31 @@ int GolfSolver::get_possible_moves(int *a, int *numout)
             if (RANK(card) == RANK(top) - 1 ||
                 RANK(card) == RANK(top) + 1 )
             {
-                mp->card_index = 0;
-                mp->from = w;
-                mp->to = 7;
-                mp->totype = W_Type;
-                mp->pri = 13;
-                if ( RANK( card ) == PS_ACE || RANK( card ) == PS_KING )
-                    mp->pri = 30;
-                mp->turn_index = -1;
+                *mp++ = column_move( w, card );
                 n++;
-                mp++;
             }
         }
     }
 
-    /* check for deck->pile */
-    if ( !n && Wlen[8] ) {
-        mp->card_index = 1;
-        mp->from = 8;
-        mp->to = 7;
-        mp->totype = W_Type;
-        mp->pri = 5;
-        mp->turn_index = 0;
+    /* check for deck->pile, which may be the better move even if there
+       are others */
+    if ( Wlen[8] ) {
+        *mp++ = talon_move();
         n++;
-        mp++;
     }
 
     return n;
 }
 
+/* The game is won with the columns cleared: the rest of the talon can go
+   to the waste anyway (see Golf::drop()). */
+
 bool GolfSolver::isWon()
 {
-
-    return Wlen[7] == 52 ;
+    for ( int w = 0; w < 7; ++w )
+        if ( Wlen[w] )
+            return false;
+    return true;
 }
 
 int GolfSolver::getOuts()
@@ -183,7 +205,7 @@ int GolfSolver::getOuts()
 }
 
 GolfSolver::GolfSolver(const Golf *dealer)
-    : Solver()
+    : SolverCore<GolfSolver>()
 {
     setNumberPiles( 9 );
     deal = dealer;
@@ -239,6 +261,234 @@ MoveHint GolfSolver::translateMove( const MOVE &m )
     return MoveHint( card, deal->waste, m.pri );
 }
 
+/* The exact solver.  Only the ranks matter in Golf, and the cards of a
+   column go to the waste from the top down, so a position is told apart
+   by the heights of the columns, the number of cards drawn from the talon
+   and where the top card of the waste came from: one of the columns, or
+   the talon (or the waste as it was at the start, before anything was
+   drawn).
+
+   The heights make a number, in which a card played from a column takes
+   one off, and a card drawn changes nothing.  So going through the
+   heights from the start down, every position comes after those it can
+   be reached from.  For each height and each column, one bit for every
+   number of cards drawn tells whether there is a position with the top
+   card of the waste from that column; there is one with the top card from
+   the talon for every number above the lowest of those.  One sweep finds
+   all the positions there are, without a search, in a table of at most
+   6^7 heights of 7 words.  As every win plays the same column cards, the
+   one that draws the fewest cards is the shortest. */
+
+struct GolfTable
+{
+    card_t column[7][5];
+    int start[7];           /* the heights at the start */
+    int base[8];            /* of every column in the number, base[7] the numbers */
+    card_t talon[17];       /* the top card of the waste after drawing d */
+    int ntalon;
+    quint32 ranks[PS_KING + 1];     /* the d whose talon[d] has the rank */
+    quint32 *from;          /* for every number, the bits of each column */
+
+    quint32 *bits( int code ) const { return from + code * 7; }
+
+    int height( int code, int w ) const
+    {
+        return code / base[w] % ( start[w] + 1 );
+    }
+
+    card_t top( int code, int w ) const
+    {
+        return column[w][height( code, w )];
+    }
+
+    /* The bits of the positions with the top card from the talon, given
+       all the others. */
+    quint32 drawn( int code, quint32 any ) const
+    {
+        bool first = code == base[7] - 1;
+        if ( first )
+            any |= 1;
+        if ( !any )
+            return 0;
+        quint32 low = any & ( ~any + 1 );
+        quint32 above = ( ( 2u << ntalon ) - 1 ) & ~( low * 2 - 1 );
+        return first ? above | 1 : above;
+    }
+
+    quint32 all( int code ) const
+    {
+        const quint32 *b = bits( code );
+        return b[0] | b[1] | b[2] | b[3] | b[4] | b[5] | b[6];
+    }
+
+    /* Where the top card of the waste came from in a position with the
+       bit d, talon or not: the first column that has it, else 7. */
+    int source( int code, int d, int rank ) const
+    {
+        const quint32 *b = bits( code );
+        for ( int w = 0; w < 7; ++w )
+        {
+            if ( ( b[w] >> d & 1 ) &&
+                 ( !rank || qAbs( RANK( top( code, w ) ) - rank ) == 1 ) )
+                return w;
+        }
+        return 7;
+    }
+
+    /* The moves to the position, back to the start. */
+    QList<MOVE> line( int code, int d, int src ) const
+    {
+        QList<MOVE> moves;
+        while ( src != 7 || d > 0 )
+        {
+            if ( src == 7 )
+            {
+                moves.prepend( talon_move() );
+                --d;
+                src = source( code, d, 0 );
+            }
+            else
+            {
+                card_t card = top( code, src );
+                moves.prepend( column_move( src, card ) );
+                code += base[src];
+                src = source( code, d, RANK( card ) );
+            }
+        }
+        return moves;
+    }
+};
+
+/* Golf goes through all its positions in no time, so there is no need
+   for the engines, nor for a position limit. */
+
+bool GolfSolver::solve_exactly()
+{
+    GolfTable t;
+
+    /* Only a layout as dealt fits in the table. */
+    if ( Wlen[7] == 0 || Wlen[8] > 16 )
+        return false;
+    int cards = Wlen[7] + Wlen[8];
+    t.base[0] = 1;
+    for ( int w = 0; w < 7; ++w )
+    {
+        if ( Wlen[w] > 5 )
+            return false;
+        for ( int i = 0; i < Wlen[w]; ++i )
+            t.column[w][i] = W[w][i];
+        t.start[w] = Wlen[w];
+        t.base[w + 1] = t.base[w] * ( Wlen[w] + 1 );
+        cards += Wlen[w];
+    }
+    t.ntalon = Wlen[8];
+    t.talon[0] = *Wp[7];
+    for ( int d = 1; d <= t.ntalon; ++d )
+        t.talon[d] = W[8][t.ntalon - d];
+    for ( int r = 0; r <= PS_KING; ++r )
+        t.ranks[r] = 0;
+    for ( int d = 0; d <= t.ntalon; ++d )
+        t.ranks[RANK( t.talon[d] )] |= 1u << d;
+
+    t.from = (quint32 *)calloc( t.base[7] * 7, sizeof( quint32 ) );
+    if ( !t.from )
+        return false;
+
+    int a, numout;
+    int n = get_possible_moves( &a, &numout );
+    for ( int i = 0; i < n; ++i )
+        firstMoves.append( Possible[i] );
+    if ( m_listener )
+        m_listener->firstMovesFound( firstMoves );
+
+    /* The sweep.  Every position passes on its bits to the ones a card
+       played from it leads to, by the rank of its top card. */
+
+    int h[7], left = cards - Wlen[7] - Wlen[8];
+    quint64 expanded = 0, positions = 0, generated = 0;
+    int bestcode = t.base[7] - 1;
+    for ( int w = 0; w < 7; ++w )
+        h[w] = t.start[w];
+    for ( int code = t.base[7] - 1; code >= 0; --code )
+    {
+        if ( ( code & 0xFFF ) == 0 && interrupted( true ) )
+            break;
+
+        quint32 *b = t.bits( code );
+        quint32 any = t.all( code );
+        quint32 drawn = t.drawn( code, any );
+        if ( any | drawn )
+        {
+            ++expanded;
+            positions += set_count( ( (cardset_t)b[0] << 32 ) | b[1] ) +
+                         set_count( ( (cardset_t)b[2] << 32 ) | b[3] ) +
+                         set_count( ( (cardset_t)b[4] << 32 ) | b[5] ) +
+                         set_count( ( (cardset_t)b[6] << 32 ) | drawn );
+
+            quint32 byrank[PS_KING + 2] = { 0 };
+            for ( int r = PS_ACE; r <= PS_KING; ++r )
+                byrank[r] = drawn & t.ranks[r];
+            for ( int w = 0; w < 7; ++w )
+                if ( b[w] )
+                    byrank[RANK( t.column[w][h[w]] )] |= b[w];
+
+            for ( int w = 0; w < 7; ++w )
+            {
+                if ( h[w] )
+                {
+                    int r = RANK( t.column[w][h[w] - 1] );
+                    quint32 next = byrank[r - 1] | byrank[r + 1];
+                    t.bits( code - t.base[w] )[w] |= next;
+                    generated += set_count( next );
+                }
+            }
+
+            /* Whatever the position, the rest of the talon can be
+               drawn. */
+            if ( cards - left > (int)Stats.bestouts )
+            {
+                Stats.bestouts = cards - left;
+                bestcode = code;
+            }
+        }
+
+        /* The next lower heights. */
+        for ( int w = 0; w < 7 && code; ++w )
+        {
+            if ( h[w] )
+            {
+                --h[w];
+                --left;
+                break;
+            }
+            h[w] = t.start[w];
+            left += t.start[w];
+        }
+    }
+
+    Stats.expanded = expanded;
+    Stats.positions = positions;
+    Stats.generated = generated;
+
+    if ( Status == NoSolutionExists )
+    {
+        quint32 any = t.all( 0 );
+        quint32 drawn = t.drawn( 0, any );
+        if ( any | drawn )
+        {
+            int d = 0;
+            while ( !( ( any | drawn ) >> d & 1 ) )
+                ++d;
+            Status = SolutionExists;
+            winMoves = t.line( 0, d, t.source( 0, d, 0 ) );
+        }
+    }
+    bestMoves = t.line( bestcode, t.ntalon, t.source( bestcode, t.ntalon, 0 ) );
+
+    ::free( t.from );
+    return true;
+}
+
 void GolfSolver::print_layout()
 {
     fprintf(stderr, "print-layout-begin\n");
@@ -256,3 +506,5 @@ void GolfSolver::print_layout()
     }
     fprintf(stderr, "print-layout-end\n");
 }
+
+template class SolverCore<GolfSolver>;
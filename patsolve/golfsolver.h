@@ -19,10 +19,10 @@
 #define GOLFSOLVER_H
 
 class Golf;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class GolfSolver : public Solver
+class GolfSolver : public SolverCore<GolfSolver>
 {
 public:
     explicit GolfSolver(const Golf *dealer);
@@ -34,10 +34,14 @@ public:
     int getOuts() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new GolfSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
     const Golf *deal;
+
+protected:
+    bool solve_exactly() Q_DECL_OVERRIDE;
 };
 
 #endif // GOLFSOLVER_H
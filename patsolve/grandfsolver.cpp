@@ -199,7 +199,7 @@ void GrandfSolver::undo_move(MOVE *m)
         {
             int pile = m_redeal * 7 + i;
             Wlen[pile] = 0;
-            Wp[pile] = &W[pile][0];
+            Wp[pile] = &W[pile][-1];
             hashpile( pile );
         }
         m_redeal--;
@@ -403,7 +403,7 @@ int GrandfSolver::getOuts()
 }
 
 GrandfSolver::GrandfSolver(const Grandf *dealer)
-    : Solver()
+    : SolverCore<GrandfSolver>()
 {
     Osuit[0] = PS_DIAMOND;
     Osuit[1] = PS_CLUB;
@@ -505,3 +505,5 @@ void GrandfSolver::print_layout()
     fprintf( stderr, "\nRedeals: %d", m_redeal );
     fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<GrandfSolver>;
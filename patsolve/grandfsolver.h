@@ -19,10 +19,10 @@
 #define GRANDFSOLVER_H
 
 class Grandf;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class GrandfSolver : public Solver
+class GrandfSolver : public SolverCore<GrandfSolver>
 {
 public:
     explicit GrandfSolver(const Grandf *dealer);
@@ -36,6 +36,7 @@ public:
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new GrandfSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
@@ -441,7 +441,7 @@ int GypsySolver::getOuts()
 }
 
 GypsySolver::GypsySolver(const Gypsy *dealer)
-    : Solver()
+    : SolverCore<GypsySolver>()
 {
     setNumberPiles( 8 + 1 + 8 );
     deal = dealer;
@@ -462,6 +462,15 @@ GypsySolver::GypsySolver(const Gypsy *dealer)
     }
 }
 
+/* The two Out piles of suit s become those of perm[s]. */
+
+int GypsySolver::suit_pile( int w, const int *perm )
+{
+    if ( w < outs )
+        return w;
+    return outs + perm[( w - outs ) / 2] * 2 + ( w - outs ) % 2;
+}
+
 /* Read a layout file.  Format is one pile per line, bottom to top (visible
    card).  Temp cells and Out on the last two lines, if any. */
 
@@ -558,3 +567,5 @@ MoveHint GypsySolver::translateMove( const MOVE &m )
 
     return MoveHint( card, deal->store[m.to], m.pri );
 }
+
+template class SolverCore<GypsySolver>;
@@ -19,10 +19,10 @@
 #define GYPSYSOLVER_H
 
 class Gypsy;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class GypsySolver : public Solver
+class GypsySolver : public SolverCore<GypsySolver>
 {
 public:
     explicit GypsySolver(const Gypsy *dealer);
@@ -33,7 +33,9 @@ public:
     void undo_move(MOVE *m) Q_DECL_OVERRIDE;
     int getOuts() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
+    int suit_pile( int w, const int *perm ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new GypsySolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
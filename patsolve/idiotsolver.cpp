@@ -199,7 +199,7 @@ int IdiotSolver::getOuts()
 }
 
 IdiotSolver::IdiotSolver(const Idiot *dealer)
-    : Solver()
+    : SolverCore<IdiotSolver>()
 {
     setNumberPiles( 6 );
     deal = dealer;
@@ -302,3 +302,5 @@ bool IdiotSolver::canMoveAway(int pile ) const
              ( Wlen[2] && higher( *Wp[pile], *Wp[2] ) ) ||
              ( Wlen[3] && higher( *Wp[pile], *Wp[3] ) ) );
 }
+
+template class SolverCore<IdiotSolver>;
@@ -19,10 +19,10 @@
 #define IDIOTSOLVER_H
 
 class Idiot;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class IdiotSolver : public Solver
+class IdiotSolver : public SolverCore<IdiotSolver>
 {
 public:
     explicit IdiotSolver(const Idiot *dealer);
@@ -33,6 +33,7 @@ public:
     int getOuts() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new IdiotSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
@@ -61,7 +61,7 @@ void KlondikeSolver::make_move(MOVE *m)
                 W[8][Wlen[8]-1] = card;
                 Wlen[7]--;
             }
-            Wp[7] = &W[7][0];
+            Wp[7] = &W[7][Wlen[7]-1];
             Wp[8] = &W[8][Wlen[8]-1];
             hashpile( 7 );
             hashpile( 8 );
@@ -165,7 +165,7 @@ void KlondikeSolver::undo_move(MOVE *m)
                 W[7][Wlen[7]-1] = card;
                 Wlen[8]--;
             }
-            Wp[8] = &W[8][0];
+            Wp[8] = &W[8][Wlen[8]-1];
             Wp[7] = &W[7][Wlen[7]-1];
             hashpile( 7 );
             hashpile( 8 );
@@ -287,10 +287,20 @@ int KlondikeSolver::good_automove(int o, int r)
 
 int KlondikeSolver::get_possible_moves(int *a, int *numout)
 {
-    int w, o, empty;
+    int w, o;
     card_t card;
+    cardset_t out, fits;
     MOVE *mp;
 
+    /* The cards that can go out, see cardset.h. */
+
+    out = 0;
+    for (o = 0; o < 4; ++o) {
+        if (O[o] != PS_KING) {
+            out |= card_bit(Osuit[o] + O[o] + 1);
+        }
+    }
+
     /* Check for moves from W to O. */
 
     int n = 0;
@@ -299,9 +309,7 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
         if (Wlen[w] > 0) {
             card = *Wp[w];
             o = SUIT(card);
-            empty = (O[o] == NONE);
-            if ((empty && (RANK(card) == PS_ACE)) ||
-                (!empty && (RANK(card) == O[o] + 1))) {
+            if (card_bit(card) & out) {
                 mp->card_index = 0;
                 mp->from = w;
                 mp->to = o;
@@ -356,8 +364,21 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
             break;
         }
 
+    // the cards that fit on the top of a play pile, and the kings if
+    // there is an empty one; a pile with none of them has nothing to move
+    fits = 0;
+    for (w = 0; w < 7; ++w)
+        if ( Wlen[w] > 0 )
+            fits |= card_bit( *Wp[w] );
+    fits = set_fits_alternate( fits );
+    if ( first_empty_pile >= 0 && first_empty_pile < 7 )
+        fits |= set_of_rank( PS_KING );
+
     for(int i=0; i<8; ++i)
     {
+        if ( !( Wset[i] & fits ) )
+            continue;
+
         int len = Wlen[i];
         if ( i == 7 && Wlen[i] > 0)
             len = 1;
@@ -366,6 +387,8 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
             card_t card = W[i][Wlen[i]-1-l];
             if ( DOWN( card ) )
                 break;
+            if ( !( card_bit( card ) & fits ) )
+                continue;
 
             for (int j = 0; j < 7; ++j)
             {
@@ -396,17 +419,10 @@ int KlondikeSolver::get_possible_moves(int *a, int *numout)
 
                 if ( allowed == 1 )
                 {
-                    //print_layout();
+                    // only worth it if the card below can go out then
                     card_t below = W[i][Wlen[i]-2-l];
-                    int o = SUIT(below);
-                    bool empty = (O[o] == NONE);
-                    //fprintf( stderr, "%d %d\n", i, l );
-                    //printcard( below, stderr );
-
-                    if ( ( empty && RANK( below ) != PS_ACE ) ||
-                         ( !empty && RANK( below ) != O[o] + 1 ) )
+                    if ( !( card_bit( below ) & out ) )
                         allowed = 0;
-                    //fprintf( stderr, " allowed %d %d %d %d\n",allowed, empty, RANK( below ), PS_ACE);
                 }
                 if ( allowed ) {
                     mp->card_index = l;
@@ -475,7 +491,7 @@ int KlondikeSolver::getOuts()
 }
 
 KlondikeSolver::KlondikeSolver(const Klondike *dealer, int draw)
-    : Solver(), m_draw( draw )
+    : SolverCore<KlondikeSolver>(), m_draw( draw )
 {
     Osuit[0] = PS_DIAMOND;
     Osuit[1] = PS_CLUB;
@@ -601,3 +617,5 @@ void KlondikeSolver::print_layout()
     }
     fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<KlondikeSolver>;
@@ -19,10 +19,10 @@
 #define KLONDIKESOLVER_H
 
 class Klondike;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class KlondikeSolver : public Solver
+class KlondikeSolver : public SolverCore<KlondikeSolver>
 {
 public:
     KlondikeSolver(const Klondike *dealer, int draw);
@@ -36,6 +36,7 @@ public:
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new KlondikeSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
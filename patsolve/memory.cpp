@@ -21,6 +21,7 @@
 #include <QDebug>
 
 #include <QtCore/QtGlobal>
+#include <QtCore/QTemporaryFile>
 
 #include <cstdlib>
 #include <cstring>
@@ -32,7 +33,26 @@
 /* Add it to the binary tree for this cluster.  The piles are stored
 following the TREE structure. */
 
-size_t MemoryManager::Mem_remain = 30 * 1000 * 1000;
+#define MEM_LIMIT (30 * 1000 * 1000)
+
+size_t MemoryManager::Mem_limit = MEM_LIMIT;
+size_t MemoryManager::Mem_remain = MEM_LIMIT;
+QMutex MemoryManager::Mem_mutex;
+
+MemoryManager::MemoryManager()
+    : Pilebytes(0),
+      Keybytes(0),
+      Storemode(HASH_STORE),
+      Segbits(0),
+      Locked(false),
+      Block(NULL),
+      Keyblock(NULL),
+      Tables(NULL),
+      Tablelocks(NULL)
+{
+	memset(Slab, 0, sizeof(Slab));
+	memset(Treelist, 0, sizeof(Treelist));
+}
 
 MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, TREE **node)
 {
@@ -51,7 +71,7 @@ MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, T
 	}
 	while (1) {
 		tkey = (quint8 *)t + sizeof(TREE);
-		c = memcmp(key, tkey, Pilebytes);
+		c = key_compare(key, tkey);
 		if (c == 0) {
 			break;
 		}
@@ -77,20 +97,289 @@ MemoryManager::inscode MemoryManager::insert_node(TREE *n, int d, TREE **tree, T
         return FOUND;
 }
 
-/* Given a cluster number, return a tree.  There are 14^4 possible
-clusters, but we'll only use a few hundred of them at most.  Hash on
-the cluster number, then locate its tree, creating it if necessary. */
+/* Add the key to the hash table, unless an equal key of the same cluster is
+already in it.  Linear probing on power of two segments; the segment and the
+slot index are taken from the high bits of a multiplicative hash, so the
+weak low bits of FNV don't matter. */
+
+#define TABLE_INITIAL_BITS 14
+#define TABLE_MULTIPLIER Q_UINT64_C(0x9E3779B97F4A7C15)  /* 2^64 / golden ratio */
+
+MemoryManager::inscode MemoryManager::insert_key(quint8 *key, unsigned int cluster, quint8 **node)
+{
+	quint32 hash;
+
+	hash = fnv_hash_buf(key, key_length(key));
+	hash = fnv_hash(cluster, hash);
+
+	return insert_slot(key, 0, hash, cluster, node);
+}
+
+/* Like insert_key(), but the table only keeps a 64 bit print of the key,
+which together with the hash and the cluster tells positions apart as good
+as certain.  The key stays with the caller, who may give it back. */
+
+MemoryManager::inscode MemoryManager::insert_print(const quint8 *key, unsigned int cluster)
+{
+	quint32 hash;
+	quint64 print;
+	quint8 *node;
+
+	hash = fnv_hash_buf(key, key_length(key));
+	hash = fnv_hash(cluster, hash);
+	print = key_print(key) | 1;     /* never 0 */
+
+	return insert_slot(NULL, print, hash, cluster, &node);
+}
+
+/* Look for a position without adding it, the way insert_key() or (if
+print is set) insert_print() would have stored it. */
+
+bool MemoryManager::find_key(const quint8 *key, unsigned int cluster, bool print)
+{
+	quint32 hash;
+	quint8 *node;
+
+	hash = fnv_hash_buf(key, key_length(key));
+	hash = fnv_hash(cluster, hash);
+
+	if (print) {
+		return insert_slot(NULL, key_print(key) | 1, hash,
+		                   cluster, &node, false) == FOUND;
+	}
+	return insert_slot((quint8 *)key, 0, hash, cluster, &node, false) == FOUND;
+}
+
+MemoryManager::inscode MemoryManager::insert_slot(quint8 *key, quint64 print, quint32 hash,
+                                                  unsigned int cluster, quint8 **node,
+                                                  bool add)
+{
+	quint64 m;
+	size_t i, mask;
+	int seg;
+	TABLE *t;
+	SLOT *s;
+
+	if (Tables == NULL) {
+		return ERR;
+	}
+
+	m = hash * TABLE_MULTIPLIER;
+	seg = Segbits ? (int)(m >> (64 - Segbits)) : 0;
+	t = &Tables[seg];
+	QMutexLocker lock(Locked ? &Tablelocks[seg] : NULL);
+
+	/* Keep the load factor below 3/4.  If there is no memory left to
+	grow, keep filling up the table for as long as probing stays cheap. */
+
+	if (add && t->count * 4 >= t->size * 3 && !grow_table(t) &&
+	    t->count * 16 >= t->size * 15) {
+		return ERR;
+	}
+
+	mask = t->size - 1;
+	i = (quint32)(m >> (32 - Segbits)) >> t->shift;
+	for (;;) {
+		s = &t->entries[i];
+		if (s->print == 0) {
+			break;
+		}
+		if (s->hash == hash && s->cluster == cluster &&
+		    (key ? key_compare(s->key, key) == 0 : s->print == print)) {
+			*node = s->key;
+			return FOUND;
+		}
+		i = (i + 1) & mask;
+	}
+	if (!add) {
+		return NEW;
+	}
+
+	if (key) {
+		s->print = 0;
+		s->key = key;
+	} else {
+		s->print = print;
+	}
+	s->hash = hash;
+	s->cluster = cluster;
+	t->count++;
+	*node = key;
+
+	return NEW;
+}
+
+/* Double the size of a table segment.  The entries remember their hash, so
+the keys don't need to be looked at again. */
+
+bool MemoryManager::grow_table(TABLE *t)
+{
+	SLOT *old, *s, *entries;
+	size_t oldsize, size, i, j, mask;
+	int bits, shift;
+
+	old = t->entries;
+	oldsize = t->size;
+	if (old == NULL) {
+		bits = qMax(TABLE_INITIAL_BITS - Segbits, 4);
+	} else {
+		bits = 32 - t->shift + 1;
+	}
+	if (bits > 31) {
+		return false;
+	}
+
+	/* Any worker may grow a segment, so this can't come from the arena
+	of the store. */
+
+	entries = (SLOT *)allocate_memory(sizeof(SLOT) << bits);
+	if (entries == NULL) {
+		return false;
+	}
+	count(Tablemem, sizeof(SLOT) << bits);
+	size = (size_t)1 << bits;
+	shift = 32 - bits;
+	mask = size - 1;
+
+	for (i = 0; i < oldsize; i++) {
+		s = &old[i];
+		if (s->print == 0) {
+			continue;
+		}
+		j = (quint32)((s->hash * TABLE_MULTIPLIER) >> (32 - Segbits)) >> shift;
+		while (entries[j].print) {
+			j = (j + 1) & mask;
+		}
+		entries[j] = *s;              /* struct copy */
+	}
+	if (old) {
+		free_memory(old, sizeof(SLOT) * oldsize);
+		count(Tablemem, -(quint64)(sizeof(SLOT) * oldsize));
+	}
+	t->entries = entries;
+	t->size = size;
+	t->shift = shift;
 
-#define TBUCKETS 499    /* a prime */
+	return true;
+}
+
+/* Allocate room for a packed position, as much as the largest one can take.
+In the tree store the key follows the TREE node, which gets filled in later
+by insert_node().  The hash table doesn't need the node, so there the key is
+all we allocate. */
 
-TREELIST *Treelist[TBUCKETS];
+quint8 *MemoryManager::new_key(void)
+{
+	quint8 *p;
+
+	p = new_from_chain(&Keyblock, Keybytes);
+	if (p != NULL && Storemode == TREE_STORE) {
+		p += sizeof(TREE);
+	}
+
+	return p;
+}
+
+/* Once the key is packed, give back what it didn't use.  The hash table
+keys are packed back to back; the tree nodes have to stay aligned. */
+
+void MemoryManager::trim_key(quint8 *key)
+{
+	size_t s;
+	BLOCK *b;
+
+	b = Keyblock;
+	s = key_length(key);
+	if (Storemode == TREE_STORE) {
+		key -= sizeof(TREE);
+		s = (s + sizeof(TREE) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+	}
+	b->remain += b->ptr - (key + s);
+	b->ptr = key + s;
+}
+
+/* Undo new_key(); the same rules as for give_back_block() apply, except
+that two keys may be given back, the later one first.  If the later one
+started a new block, the earlier one is left where it is: the rest of
+that block is lost anyway. */
+
+void MemoryManager::give_back_key(quint8 *key)
+{
+	BLOCK *b;
+
+	if (Storemode == TREE_STORE) {
+		key -= sizeof(TREE);
+	}
+	b = Keyblock;
+	if (key < b->block || key >= b->ptr) {
+		return;
+	}
+	b->remain += b->ptr - key;
+	b->ptr = key;
+}
+
+/* Given a cluster number, return a tree.  There are 14^4 possible
+clusters, but we'll only use a few hundred of them at most.  Hash on
+the cluster number, then locate its tree, creating it if necessary.
+Every store has trees of its own, so solvers in different threads don't
+get in each other's way. */
 
 /* Clusters are also stored in a hashed array. */
 
 void MemoryManager::init_clusters(void)
 {
+	int i, n;
+
 	memset(Treelist, 0, sizeof(Treelist));
+
+	if (Storemode == HASH_STORE) {
+		n = 1 << Segbits;
+		Tables = new_array(this, TABLE, n);
+		if (Tables == NULL) {
+			return;
+		}
+		memset(Tables, 0, n * sizeof(TABLE));
+		for (i = 0; i < n; i++) {
+			grow_table(&Tables[i]);
+		}
+		if (Locked) {
+			Tablelocks = new QMutex[n];
+		}
+	}
+}
+
+/* Add bytes, which may be negative, to a part of the store.  Counting
+the peak here catches the moment a table segment is grown, when it is
+there twice. */
+
+void MemoryManager::count(QAtomicInteger<quint64> &part, quint64 bytes)
+{
+	quint64 used, peak;
+
+	part.fetchAndAddRelaxed(bytes);
+	if ((qint64)bytes < 0) {
+		return;
+	}
+	used = Nodemem.load() + Keymem.load() + Tablemem.load();
+	peak = Peak.load();
+	while (used > peak && !Peak.testAndSetRelaxed(peak, used)) {
+		peak = Peak.load();
+	}
+}
+
+void MemoryManager::reset_peak(void)
+{
+	Peak.store(Nodemem.load() + Keymem.load() + Tablemem.load());
+}
+
+/* Every solver allocates its positions from blocks of its own. */
+
+void MemoryManager::init_blocks(void)
+{
 	Block = new_block();                    /* @@@ */
+	Keyblock = NULL;
+	Nodemem.store(Block ? BLOCKSIZE : 0);
+	Keymem.store(0);
 }
 
 TREELIST *MemoryManager::cluster_tree(unsigned int cluster)
@@ -115,7 +404,7 @@ TREELIST *MemoryManager::cluster_tree(unsigned int cluster)
 	/* If we didn't find it, make a new one and add it to the list. */
 
 	if (tl == NULL) {
-		tl = mm_allocate(TREELIST);
+		tl = mm_allocate(this, TREELIST);
 		if (tl == NULL) {
 			return NULL;
 		}
@@ -132,23 +421,24 @@ TREELIST *MemoryManager::cluster_tree(unsigned int cluster)
 	return tl;
 }
 
-/* Block storage.  Reduces overhead, and can be freed quickly. */
+/* Block storage.  Reduces overhead, and can be freed quickly.  The BLOCK
+itself sits at the start of the memory it describes. */
+
+#define BLOCKHEAD ((sizeof(BLOCK) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
 
 BLOCK *MemoryManager::new_block(void)
 {
 	BLOCK *b;
+	quint8 *p;
 
-	b = mm_allocate(BLOCK);
-	if (b == NULL) {
-		return NULL;
-	}
-	b->block = new_array(quint8, BLOCKSIZE);
-	if (b->block == NULL) {
-                MemoryManager::free_ptr(b);
+	p = (quint8 *)allocate_memory(BLOCKSIZE);
+	if (p == NULL) {
 		return NULL;
 	}
-	b->ptr = b->block;
-	b->remain = BLOCKSIZE;
+	b = (BLOCK *)p;
+	b->block = p;
+	b->ptr = p + BLOCKHEAD;
+	b->remain = BLOCKSIZE - BLOCKHEAD;
 	b->next = NULL;
 
 	return b;
@@ -157,18 +447,24 @@ BLOCK *MemoryManager::new_block(void)
 /* Like new(), only from the current block.  Make a new block if necessary. */
 
 quint8 *MemoryManager::new_from_block(size_t s)
+{
+	return new_from_chain(&Block, s);
+}
+
+quint8 *MemoryManager::new_from_chain(BLOCK **chain, size_t s)
 {
 	quint8 *p;
 	BLOCK *b;
 
-	b = Block;
-	if (s > b->remain) {
+	b = *chain;
+	if (b == NULL || s > b->remain) {
 		b = new_block();
 		if (b == NULL) {
 			return NULL;
 		}
-		b->next = Block;
-		Block = b;
+		count(chain == &Keyblock ? Keymem : Nodemem, BLOCKSIZE);
+		b->next = *chain;
+		*chain = b;
 	}
 
 	p = b->ptr;
@@ -178,6 +474,54 @@ quint8 *MemoryManager::new_from_block(size_t s)
 	return p;
 }
 
+/* Allocate from the free list of the size class, or from the block if
+that's empty.  Large requests go straight to malloc(). */
+
+void *MemoryManager::new_from_slab(size_t s)
+{
+	int c;
+	void *p;
+
+	s = qMax(s, (size_t)SLAB_ALIGN);
+	s = (s + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+	if (s > SLAB_ALIGN * SLAB_CLASSES) {
+		p = allocate_memory(s);
+		if (p != NULL) {
+			count(Nodemem, s);
+		}
+		return p;
+	}
+
+	c = s / SLAB_ALIGN - 1;
+	p = Slab[c];
+	if (p != NULL) {
+		Slab[c] = *(void **)p;
+		return p;
+	}
+
+	return new_from_block(s);
+}
+
+/* Put p on the free list of its size class.  It may come from the arena
+of another solver, as long as both live until the end of the search. */
+
+void MemoryManager::give_back_slab(void *p, size_t s)
+{
+	int c;
+
+	s = qMax(s, (size_t)SLAB_ALIGN);
+	s = (s + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+	if (s > SLAB_ALIGN * SLAB_CLASSES) {
+		free_memory(p, s);
+		count(Nodemem, -(quint64)s);
+		return;
+	}
+
+	c = s / SLAB_ALIGN - 1;
+	*(void **)p = Slab[c];
+	Slab[c] = p;
+}
+
 /* Return the previous result of new_from_block() to the block.  This
 can ONLY be called once, immediately after the call to new_from_block().
 That is, no other calls to new_from_block() are allowed. */
@@ -200,35 +544,56 @@ void MemoryManager::free_blocks(void)
 	b = Block;
 	while (b) {
 		next = b->next;
-                MemoryManager::free_array(b->block, BLOCKSIZE);
-                MemoryManager::free_ptr(b);
+		free_memory(b->block, BLOCKSIZE);
+		b = next;
+	}
+	Block = NULL;
+	b = Keyblock;
+	while (b) {
+		next = b->next;
+		free_memory(b->block, BLOCKSIZE);
 		b = next;
 	}
+	Keyblock = NULL;
+	memset(Slab, 0, sizeof(Slab));
+	Nodemem.store(0);
+	Keymem.store(0);
 }
 
+/* The tree lists and the segment array live in the arena, they go with
+free_blocks(). */
+
 void MemoryManager::free_clusters(void)
 {
 	int i;
-	TREELIST *l, *n;
 
-	for (i = 0; i < TBUCKETS; i++) {
-		l = Treelist[i];
-		while (l) {
-			n = l->next;
-                        MemoryManager::free_ptr(l);
-			l = n;
+	memset(Treelist, 0, sizeof(Treelist));
+
+	if (Tables) {
+		for (i = 0; i < 1 << Segbits; i++) {
+			if (Tables[i].entries) {
+				free_memory(Tables[i].entries, sizeof(SLOT) * Tables[i].size);
+			}
 		}
+		Tables = NULL;
 	}
+	Tablemem.store(0);
+	delete [] Tablelocks;
+	Tablelocks = NULL;
 }
 
-/* Allocate some space and return a pointer to it.  See new() in util.h. */
+/* Allocate some space and return a pointer to it.  This is where the
+memory limit is enforced, so Mem_remain only counts what we really got
+from malloc(): blocks and large arrays.  Past the limit, the memory may
+come from the spill file. */
 
 void *MemoryManager::allocate_memory(size_t s)
 {
 	void *x;
 
+	QMutexLocker lock(&Mem_mutex);
 	if (s > Mem_remain) {
-		return NULL;
+		return spill_memory(s);
 	}
 
 	if ((x = (void *)malloc(s)) == NULL) {
@@ -239,3 +604,147 @@ void *MemoryManager::allocate_memory(size_t s)
 	Mem_remain -= s;
 	return x;
 }
+
+void MemoryManager::free_memory(void *p, size_t s)
+{
+	QMutexLocker lock(&Mem_mutex);
+	if (free_spill(p, s)) {
+		return;
+	}
+
+	free(p);
+	Mem_remain += s;
+}
+
+/* What is allocated now stays counted against the new limit. */
+
+void MemoryManager::set_limit(size_t limit)
+{
+	size_t used;
+
+	QMutexLocker lock(&Mem_mutex);
+	used = Mem_limit - qMin(Mem_remain, Mem_limit);
+	Mem_remain = limit > used ? limit - used : 0;
+	Mem_limit = limit;
+}
+
+size_t MemoryManager::limit(void)
+{
+	QMutexLocker lock(&Mem_mutex);
+	return Mem_limit;
+}
+
+/* Spilling.  The spill file is mapped in regions of SPILL_REGION bytes,
+which are carved up from start to end, just like the blocks they are
+mostly used for.  So the system can write back the cold parts of the
+store and the queues in long sequential runs, and page them out; they
+come back when they are needed.  The file only grows during a search,
+it is removed when everything in it has been freed, which happens at
+the end of the search. */
+
+#define SPILL_REGION (16 * 1024 * 1024)
+#define SPILL_ALIGN (64 * 1024)
+
+struct SPILL {
+	uchar *base;
+	size_t size;
+	size_t used;
+	SPILL *next;
+};
+
+size_t MemoryManager::Spill_remain = 0;
+
+static QString Spill_dir;
+static QTemporaryFile *Spill_file = NULL;
+static SPILL *Spills = NULL;            /* the current region first */
+static qint64 Spill_end = 0;            /* the size of the file */
+static size_t Spill_live = 0;           /* bytes not freed yet */
+
+void MemoryManager::set_spill(const QString &dir, size_t cap)
+{
+	QMutexLocker lock(&Mem_mutex);
+	Spill_dir = dir;
+	Spill_remain = dir.isEmpty() ? 0 : cap;
+}
+
+/* Take s bytes from the spill file.  The caller holds Mem_mutex.  A new
+file starts out all zeros, like allocate_memory() promises. */
+
+void *MemoryManager::spill_memory(size_t s)
+{
+	SPILL *r;
+	uchar *p;
+	size_t size;
+
+	s = (s + SPILL_ALIGN - 1) & ~(size_t)(SPILL_ALIGN - 1);
+	r = Spills;
+	if (r == NULL || r->size - r->used < s) {
+		size = qMax((size_t)SPILL_REGION, s);
+		if (Spill_dir.isEmpty() || size > Spill_remain) {
+			return NULL;
+		}
+		if (Spill_file == NULL) {
+			Spill_file = new QTemporaryFile(Spill_dir + QLatin1String("/kpat-solver-XXXXXX"));
+			if (!Spill_file->open()) {
+				delete Spill_file;
+				Spill_file = NULL;
+				return NULL;
+			}
+		}
+		if (!Spill_file->resize(Spill_end + size)) {
+			return NULL;
+		}
+		p = Spill_file->map(Spill_end, size);
+		if (p == NULL) {
+			return NULL;
+		}
+		r = new SPILL;
+		r->base = p;
+		r->size = size;
+		r->used = 0;
+		r->next = Spills;
+		Spills = r;
+		Spill_end += size;
+		Spill_remain -= size;
+	}
+
+	p = r->base + r->used;
+	r->used += s;
+	Spill_live += s;
+
+	return p;
+}
+
+/* Give back memory that came from the spill file; return false if p
+didn't.  Once all of it is back, the regions are unmapped and the file
+is removed.  The caller holds Mem_mutex. */
+
+bool MemoryManager::free_spill(void *p, size_t s)
+{
+	SPILL *r;
+
+	for (r = Spills; r; r = r->next) {
+		if ((uchar *)p >= r->base && (uchar *)p < r->base + r->size) {
+			break;
+		}
+	}
+	if (r == NULL) {
+		return false;
+	}
+
+	s = (s + SPILL_ALIGN - 1) & ~(size_t)(SPILL_ALIGN - 1);
+	Spill_live -= s;
+	if (Spill_live == 0) {
+		while ((r = Spills) != NULL) {
+			Spills = r->next;
+			Spill_file->unmap(r->base);
+			Spill_remain += r->size;
+			delete r;
+		}
+		delete Spill_file;
+		Spill_file = NULL;
+		Spill_end = 0;
+	}
+
+	return true;
+}
@@ -19,12 +19,78 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <QtCore/QtGlobal>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 
+/* This is a 32 bit FNV hash.  For more information, see
+http://www.isthe.com/chongo/tech/comp/fnv/index.html */
+
+#define FNV1_32_INIT 0x811C9DC5
+#define FNV_32_PRIME 0x01000193
+
+#define fnv_hash(x, hash) (((hash) * FNV_32_PRIME) ^ (x))
+
+/* Hash a buffer. */
+
+static inline quint32 fnv_hash_buf(const quint8 *s, int len)
+{
+	int i;
+	quint32 h;
+
+	h = FNV1_32_INIT;
+	for (i = 0; i < len; i++) {
+		h = fnv_hash(*s++, h);
+	}
+
+	return h;
+}
+
+/* Packed positions start with the number of bytes that follow.  Keys of
+different length differ in the first byte, so comparing the shorter
+length is enough to order them. */
+
+static inline int key_length(const quint8 *key)
+{
+	return key[0] + 1;
+}
+
+static inline int key_compare(const quint8 *a, const quint8 *b)
+{
+	return memcmp(a, b, qMin(key_length(a), key_length(b)));
+}
+
+/* A 64 bit FNV hash of a key, independent of the 32 bit one. */
+
+#define FNV1_64_INIT Q_UINT64_C(0xCBF29CE484222325)
+#define FNV_64_PRIME Q_UINT64_C(0x100000001B3)
+
+static inline quint64 key_print(const quint8 *key)
+{
+	int i, len;
+	quint64 h;
+
+	h = FNV1_64_INIT;
+	len = key_length(key);
+	for (i = 0; i < len; i++) {
+		h = (h ^ key[i]) * FNV_64_PRIME;
+	}
+
+	return h;
+}
+
 struct TREE;
 
-/* Memory. */
+/* Memory.  Every solver has an arena of big blocks.  The packed positions
+are carved out of them for good, everything that comes and goes (move
+arrays, positions, ...) is recycled through a free list per size class.
+Only whole blocks and large arrays are malloc()ed, and nothing is returned
+before the end of the search, when the blocks are freed all at once. */
 
 struct BLOCK;
 struct BLOCK {
@@ -34,6 +100,14 @@ struct BLOCK {
         BLOCK *next;
 };
 
+#define SLAB_ALIGN 8
+#define SLAB_CLASSES 256        /* size classes of 8 bytes, up to 2k */
+
+/* The tree store keeps a binary tree of positions for every cluster.  The
+trees are found by their cluster in a small hash table of lists. */
+
+#define TBUCKETS 499    /* a prime */
+
 struct TREELIST;
 struct TREELIST {
 	TREE *tree;
@@ -52,6 +126,32 @@ struct TREE {
 	short depth;
 };
 
+/* Instead of the per-cluster trees, positions can be kept in one open
+addressing hash table.  The slot caches the hash and the cluster of the
+position, so nearly all mismatches are rejected without touching the key.
+A table that only remembers which positions it has seen keeps a second
+hash of the key instead of the key itself (see insert_print()).  A slot
+with a key has the rest of the print cleared, so whatever the size of a
+pointer, the slot is empty if and only if the print is 0. */
+struct SLOT {
+	union {
+		quint8 *key;
+		quint64 print;
+	};
+	quint32 hash;
+	quint32 cluster;
+};
+
+/* The hash table can be split into segments, selected by the top bits of
+the hash.  A parallel search gives every segment a lock of its own, so the
+workers rarely have to wait for each other. */
+struct TABLE {
+	SLOT *entries;
+	size_t size;                /* always a power of two */
+	size_t count;
+	int shift;
+};
+
 #ifdef ERR
 #undef ERR
 #endif
@@ -60,39 +160,89 @@ class MemoryManager
 {
 public:
     enum inscode { NEW, FOUND, ERR };
+    enum storemode { TREE_STORE, HASH_STORE };
+
+    MemoryManager();
 
     unsigned char *new_from_block(size_t s);
+    void *new_from_slab(size_t s);
+    void give_back_slab(void *p, size_t s);
+    void init_blocks(void);
     void init_clusters(void);
     void free_blocks(void);
     void free_clusters(void);
     TREELIST *cluster_tree(unsigned int cluster);
     inscode insert_node(TREE *n, int d, TREE **tree, TREE **node);
+    inscode insert_key(quint8 *key, unsigned int cluster, quint8 **node);
+    inscode insert_print(const quint8 *key, unsigned int cluster);
+    bool find_key(const quint8 *key, unsigned int cluster, bool print);
+    quint8 *new_key(void);
+    void trim_key(quint8 *key);
+    void give_back_key(quint8 *key);
     void give_back_block(unsigned char *p);
     void init_buckets( int i );
     BLOCK *new_block(void);
 
     template<class T>
-    static void free_ptr(T *ptr) {
-        free(ptr); Mem_remain += sizeof(T);
+    void free_ptr(T *ptr) {
+        give_back_slab(ptr, sizeof(T));
     }
 
     template<class T>
-    static void free_array(T *ptr, size_t size) {
-        free(ptr);
-        Mem_remain += size * sizeof(T);
+    void free_array(T *ptr, size_t size) {
+        give_back_slab(ptr, size * sizeof(T));
     }
 
     static void *allocate_memory(size_t s);
+    static void free_memory(void *p, size_t s);
+
+    /* Once Mem_remain is used up, go on with up to cap bytes in a file
+       in dir.  An empty dir turns it off.  Only call it between searches. */
+    static void set_spill(const QString &dir, size_t cap);
+
+    /* The most all stores together may take from malloc(), 30 MB unless
+       it was set.  Only call it between searches. */
+    static void set_limit(size_t limit);
+    static size_t limit(void);
 
     // ugly hack
-    int Pilebytes;
+    int Pilebytes;              /* the most a packed position can take */
+    int Keybytes;               /* bytes allocated for it by new_key() */
+    storemode Storemode;
+    int Segbits;                /* the table has 1 << Segbits segments */
+    bool Locked;                /* lock the segments for concurrent use */
+
+    /* The bytes held for each part of the store, for the statistics. */
+    QAtomicInteger<quint64> Nodemem;    /* positions, tree nodes and moves */
+    QAtomicInteger<quint64> Keymem;     /* packed positions */
+    QAtomicInteger<quint64> Tablemem;   /* the hash table */
+    QAtomicInteger<quint64> Peak;       /* the most of all three at once */
+    void reset_peak(void);
     static size_t Mem_remain;
+    static size_t Spill_remain;
 private:
+    inscode insert_slot(quint8 *key, quint64 print, quint32 hash,
+                        unsigned int cluster, quint8 **node, bool add = true);
+    bool grow_table(TABLE *t);
+    unsigned char *new_from_chain(BLOCK **chain, size_t s);
+    void count(QAtomicInteger<quint64> &part, quint64 bytes);
+
     BLOCK *Block;
+    BLOCK *Keyblock;            /* the keys are packed in blocks of their own */
+    void *Slab[SLAB_CLASSES];   /* free lists, linked through the first word */
+
+    TABLE *Tables;
+    QMutex *Tablelocks;
+    TREELIST *Treelist[TBUCKETS];
+
+    static void *spill_memory(size_t s);
+    static bool free_spill(void *p, size_t s);
 
+    static size_t Mem_limit;
+    static QMutex Mem_mutex;    /* guards Mem_remain and the spill file */
 };
 
-#define new_array( type, size ) ( type* )MemoryManager::allocate_memory( ( size )*sizeof( type ) );
-#define mm_allocate( type ) ( type* )MemoryManager::allocate_memory( sizeof( type ) );
+#define new_array( mm, type, size ) ( type* )( mm )->new_from_slab( ( size )*sizeof( type ) )
+#define mm_allocate( mm, type ) ( type* )( mm )->new_from_slab( sizeof( type ) )
 
 #endif // MEMORY_H
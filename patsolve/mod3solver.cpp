@@ -120,7 +120,7 @@ void Mod3Solver::undo_move(MOVE *m)
         int len = m->card_index;
         if ( len > 8 )
             len = 8;
-        for ( int i = len; i >= 0; i-- )
+        for ( int i = len - 1; i >= 0; i-- )
         {
             card_t card = *Wp[24+i];
             Wlen[deck]++;
@@ -337,7 +337,7 @@ int Mod3Solver::getOuts()
 }
 
 Mod3Solver::Mod3Solver(const Mod3 *dealer)
-    : Solver()
+    : SolverCore<Mod3Solver>()
 {
     // 24 targets, 8 playing fields, deck, aces
     setNumberPiles( 34 );
@@ -436,3 +436,5 @@ void Mod3Solver::print_layout()
 
     fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<Mod3Solver>;
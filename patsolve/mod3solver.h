@@ -19,10 +19,10 @@
 #define MOD3SOLVER_H
 
 class Mod3;
-#include "patsolve.h"
+#include "solvercore.h"
 
 
-class Mod3Solver : public Solver
+class Mod3Solver : public SolverCore<Mod3Solver>
 {
 public:
     explicit Mod3Solver(const Mod3 *dealer);
@@ -33,6 +33,7 @@ public:
     int getOuts() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new Mod3Solver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
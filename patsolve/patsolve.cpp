@@ -17,13 +17,19 @@
  */
 
 #include "patsolve.h"
+#include "solvercore.h"
 
 #include "../patpile.h"
 
 #include "KCardDeck"
 
 #include <QDebug>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 
+#include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <cstdarg>
@@ -37,52 +43,111 @@
 #undef ERR
 #endif
 
-long all_moves = 0;
+QAtomicInteger<long> all_moves;
 
-/* This is a 32 bit FNV hash.  For more information, see
-http://www.isthe.com/chongo/tech/comp/fnv/index.html */
-
-#define FNV1_32_INIT 0x811C9DC5
-#define FNV_32_PRIME 0x01000193
-
-#define fnv_hash(x, hash) (((hash) * FNV_32_PRIME) ^ (x))
-
-/* Hash a buffer. */
-
-static inline quint32 fnv_hash_buf(quint8 *s, int len)
+static void add_stats(SOLVERSTATS *to, const SOLVERSTATS &from)
 {
 	int i;
-	quint32 h;
 
-	h = FNV1_32_INIT;
-	for (i = 0; i < len; i++) {
-		h = fnv_hash(*s++, h);
+	to->generated += from.generated;
+	to->duplicates += from.duplicates;
+	to->positions += from.positions;
+	to->expanded += from.expanded;
+	to->depthsum += from.depthsum;
+	if (from.bestouts > to->bestouts) {
+		to->bestouts = from.bestouts;
 	}
-
-	return h;
+	to->movegen_ns += from.movegen_ns;
+	to->makemove_ns += from.makemove_ns;
+	to->insert_ns += from.insert_ns;
+	to->queue_ns += from.queue_ns;
+	for (i = 0; i < NQUEUES; ++i) {
+		to->queued[i] += from.queued[i];
+	}
+	to->enqueued += from.enqueued;
+	to->dequeued += from.dequeued;
+	to->qscans += from.qscans;
 }
 
-/* Hash a 0 terminated string. */
+/* The state shared by the workers of a parallel search.  Every worker is a
+complete solver with its own work arrays, queues and position blocks; the
+position store and the pile table of the first one are all they have in
+common.  Workers
+that run out of positions steal from the queues of the others, and the
+search is over once all of them are idle at the same time.  An idle worker
+sleeps until a position is queued or the search is over. */
 
-static inline quint32 fnv_hash_str(quint8 *s)
+class SolverPool
 {
-	quint32 h;
+public:
+    SolverPool() : winner( 0 ) {}
 
-	h = FNV1_32_INIT;
-	while (*s) {
-		h = fnv_hash(*s++, h);
-	}
+    /* End the search, and wake the idle workers to see it. */
+    void halt()
+    {
+        stop.store( 1 );
+        QMutexLocker lock( &idleMutex );
+        wakeup.wakeAll();
+    }
 
-	return h;
-}
+    QList<Solver *> workers;    /* the first one started the search */
+    QList<QThread *> threads;
+    QMutex treeMutex;           /* guards nchild of the positions */
+    QMutex winMutex;
+    Solver *winner;             /* the first worker that won */
+    QAtomicInt stop;            /* the search is decided, or failed */
+    QAtomicInt idle;            /* the number of idle workers */
+    QMutex idleMutex;           /* guards the sleep of the idle ones */
+    QWaitCondition wakeup;      /* a position was queued, or it's over */
+    QAtomicInt positions;       /* positions stored by all workers */
+};
+
+class SolverWorker : public QThread
+{
+public:
+    explicit SolverWorker( Solver *solver ) : m_solver( solver ) {}
+
+protected:
+    void run() Q_DECL_OVERRIDE { m_solver->work(); }
+
+private:
+    Solver *m_solver;
+};
 
+#define POOL_SEGBITS 6           /* lock the store in 64 segments */
+#define POOL_POSITIONS 10000     /* smaller searches run on one thread */
 
-/* Hash a pile. */
+/* Hash a pile.  The hash of every bottom part of the pile is kept, along
+with the cards it was computed from, so only the cards above the lowest
+one that changed since the last call need to be hashed again -- usually
+just the ones that were moved.  The result is the same as hashing the
+whole pile. */
 
 void Solver::hashpile(int w)
 {
+	int i, n;
+	card_t *c, *s;
+	quint32 *h;
+	cardset_t *set;
+
+	c = W[w];
+	s = Wseen[w];
+	h = Wprefix[w];
+	set = Wprefixset[w];
+	n = qMin(Wlen[w], Wseenlen[w]);
+	for (i = 0; i < n && c[i] == s[i]; i++) {
+		;
+	}
+	for (; i < Wlen[w]; i++) {
+		s[i] = c[i];
+		h[i + 1] = fnv_hash(c[i], h[i]);
+		set[i + 1] = set[i] | card_bit(c[i]);
+	}
+	Wseenlen[w] = Wlen[w];
+
    	W[w][Wlen[w]] = 0;
-	Whash[w] = fnv_hash_str(W[w]);
+	Whash[w] = h[Wlen[w]];
+	Wset[w] = set[Wlen[w]];
 
 	/* Invalidate this pile's id.  We'll calculate it later. */
 
@@ -96,7 +161,7 @@ bool Solver::recursive(POSITION *parent)
     int i, alln, a, numout = 0;
 
     if ( parent == NULL ) {
-        init();
+        init( mm );
         recu_pos.clear();
         delete Stack;
         Stack = new POSITION[MAXDEPTH];
@@ -134,7 +199,7 @@ bool Solver::recursive(POSITION *parent)
     if ( parent && parent->depth >= MAXDEPTH - 2 )
         return false;
 
-    MOVE *mp0 = new_array(MOVE, alln+1);
+    MOVE *mp0 = new_array(mm, MOVE, alln+1);
     if (mp0 == NULL) {
         return false;
     }
@@ -162,26 +227,26 @@ bool Solver::recursive(POSITION *parent)
 
         /* See if this is a new position. */
 
-        Total_generated++;
+        ++Stats.generated;
         POSITION *pos = &Stack[depth];
         pos->queue = NULL;
         pos->parent = parent;
         pos->node = pack_position();
-        quint8 *key = (quint8 *)pos->node + sizeof(TREE);
+        quint8 *key = pos->node;
 #if 0
-        qint32 hash = fnv_hash_buf(key, mm->Pilebytes);
+        qint32 hash = fnv_hash_buf(key, key_length(key));
         if ( recu_pos.contains( hash ) )
         {
             undo_move( mp );
-            mm->give_back_block( (quint8 *)pos->node );
+            mm->give_back_key( pos->node );
             continue;
         }
         recu_pos[hash] = true;
 #else
         for ( int i = 0; i < depth; ++i )
         {
-            quint8 *tkey = (quint8 *)Stack[i].node + sizeof(TREE);
-            if ( !memcmp( key, tkey, mm->Pilebytes ) )
+            quint8 *tkey = Stack[i].node;
+            if ( !key_compare( key, tkey ) )
             {
                 key = 0;
                 break;
@@ -190,13 +255,13 @@ bool Solver::recursive(POSITION *parent)
         if ( !key )
         {
             undo_move( mp );
-            mm->give_back_block( (quint8 *)pos->node );
+            mm->give_back_key( pos->node );
             continue;
         }
 #endif
-        Total_positions++;
-        if ( Total_positions % 10000 == 0 )
-            //qDebug() << "positions" << Total_positions;
+        ++Stats.positions;
+        if ( Stats.positions % 10000 == 0 )
+            //qDebug() << "positions" << Stats.positions;
 
         pos->move = *mp;                 /* struct copy */
         pos->cluster = 0;
@@ -206,15 +271,15 @@ bool Solver::recursive(POSITION *parent)
         bool ret = recursive(pos);
         fit |= ret;
         undo_move(mp);
-        mm->give_back_block( (quint8 *)pos->node );
+        mm->give_back_key( pos->node );
         if ( ret )
             break;
     }
 
-    MemoryManager::free_array(mp0, alln);
+    mm->free_array(mp0, alln);
 
     if ( parent == NULL ) {
-        printf( "Total %ld\n", Total_generated );
+        printf( "Total %llu\n", ( unsigned long long )Stats.generated );
         delete [] Stack;
         Stack = 0;
     }
@@ -222,78 +287,51 @@ bool Solver::recursive(POSITION *parent)
 }
 
 
-/* Generate an array of the moves we can make from this position. */
+/* Print the n moves get_possible_moves() found, for debugging. */
 
-MOVE *Solver::get_moves(int *nmoves)
+void Solver::print_moves(int n)
 {
-	int i, n, alln, a = 0, numout = 0;
-	MOVE *mp, *mp0;
-
-	/* Fill in the Possible array. */
-
-        alln = n = get_possible_moves(&a, &numout);
-	if (debug)  
-	  {
-	    print_layout();
-	    fprintf( stderr, "moves %d\n", n );
-	    for (int j = 0; j < n; j++) {
-	      fprintf( stderr,  "  " );
-	      if ( Possible[j].totype == O_Type )
-                fprintf( stderr, "move from %d out (at %d) Prio: %d\n", Possible[j].from,
-                         Possible[j].turn_index, Possible[j].pri );
-	      else
-                fprintf( stderr, "move %d from %d to %d (%d) Prio: %d\n", Possible[j].card_index,
-                         Possible[j].from, Possible[j].to,
-                         Possible[j].turn_index, Possible[j].pri );
-	    }
-	  }
-
-	/* No moves?  Maybe we won. */
-
-	if (n == 0) {
-            /* No more moves - won or lost */
-            //print_layout();
-            return NULL;
+	print_layout();
+	fprintf( stderr, "moves %d\n", n );
+	for (int j = 0; j < n; j++) {
+	  fprintf( stderr,  "  " );
+	  if ( Possible[j].totype == O_Type )
+            fprintf( stderr, "move from %d out (at %d) Prio: %d\n", Possible[j].from,
+                     Possible[j].turn_index, Possible[j].pri );
+	  else
+            fprintf( stderr, "move %d from %d to %d (%d) Prio: %d\n", Possible[j].card_index,
+                     Possible[j].from, Possible[j].to,
+                     Possible[j].turn_index, Possible[j].pri );
 	}
+}
 
-	/* Prioritize these moves.  Automoves don't get queued, so they
-	don't need a priority. */
-
-	if (!a) {
-		prioritize(Possible, alln);
-	}
+/* Copy the n moves in Possible to safe storage and return them.  Non-auto
+moves out, the first numout of them, get put at the end.  Queueing them
+isn't a good idea because they are still good moves, even if they didn't
+pass the automove test.  So we still do the recursive solve() on them,
+but only after queueing the other moves. */
 
-	/* Now copy to safe storage and return.  Non-auto moves out get put
-	at the end.  Queueing them isn't a good idea because they are still
-	good moves, even if they didn't pass the automove test.  So we still
-	do the recursive solve() on them, but only after queueing the other
-	moves. */
+MOVE *Solver::save_moves(int n, int numout, int *nmoves)
+{
+	int i;
+	MOVE *mp, *mp0;
 
-	mp = mp0 = new_array(MOVE, n);
+	mp = mp0 = new_array(mm, MOVE, n);
 	if (mp == NULL) {
+		Status = UnableToDetermineSolvability;
 		return NULL;
 	}
 	*nmoves = n;
-	i = 0;
-	if (a || numout == 0) {
-		for (i = 0; i < alln; ++i) {
-			if (Possible[i].card_index != -1) {
-				*mp = Possible[i];      /* struct copy */
-				mp++;
-			}
-		}
-	} else {
-		for (i = numout; i < alln; ++i) {
-			if (Possible[i].card_index != -1) {
-				*mp = Possible[i];      /* struct copy */
-				mp++;
-			}
+	for (i = numout; i < n; ++i) {
+		if (Possible[i].card_index != -1) {
+			*mp = Possible[i];      /* struct copy */
+			mp++;
 		}
-		for (i = 0; i < numout; ++i) {
-			if (Possible[i].card_index != -1) {
-				*mp = Possible[i];      /* struct copy */
-				mp++;
-			}
+	}
+	for (i = 0; i < numout; ++i) {
+		if (Possible[i].card_index != -1) {
+			*mp = Possible[i];      /* struct copy */
+			mp++;
 		}
 	}
 
@@ -332,84 +370,193 @@ void Solver::pilesort(void)
         //fprintf( stderr, "\n" );
 }
 
-#define NBUCKETS 65521           /* the largest 16 bit prime */
-#define NPILES   65536           /* a 16 bit code */
-
-typedef struct bucketlist {
-	quint8 *pile;           /* 0 terminated copy of the pile */
-	quint32 hash;         /* the pile's hash code */
-	int pilenum;            /* the unique id for this pile */
-	struct bucketlist *next;
-} BUCKETLIST;
-
-BUCKETLIST *Bucketlist[NBUCKETS];
-int Pilenum;                    /* the next pile number to be assigned */
-
-BUCKETLIST *Pilebucket[NPILES]; /* reverse lookup for unpack to get the bucket
-				   from the pile */
-
 /* Compact position representation.  The position is stored as an
 array with the following format:
-	pile0# pile1# ... pileN# (N = Nwpiles)
-where each pile number is packed into 16 bits (so a pile take 2 bytes).
-Positions in this format are unique can be compared with memcmp().  The O
+	len pile0# pile1# ... pileN# (N = Nwpiles)
+where len is the number of bytes that follow, and each pile number is
+packed 7 bits to the byte, low bits first, with the top bit set in all
+bytes but the last.  Most games never see more than 16K different piles,
+so a pile takes one or two bytes.  Positions in this format are unique and
+can be compared with memcmp(), see key_compare().  The O
 cells are encoded as a cluster number: no two positions with different
 cluster numbers can ever be the same, so we store different clusters in
-different trees.  */
-
-int Treebytes;
+different trees (or tag them with the cluster in the hash table).  */
 
-TREE *Solver::pack_position(void)
+quint8 *Solver::pack_position(void)
 {
 	int j, w;
-	quint8 *p;
-	TREE *node;
+	quint8 *p, *q;
 
-	/* Allocate space and store the pile numbers.  The tree node
-	will get filled in later, by insert_node(). */
+	/* Allocate space and store the pile numbers.  In the tree store
+	the tree node will get filled in later, by insert_node(). */
 
-	p = mm->new_from_block(Treebytes);
+	p = mm->new_key();
 	if (p == NULL) {
                 Status = UnableToDetermineSolvability;
 		return NULL;
 	}
-	node = (TREE *)p;
-	p += sizeof(TREE);
 
-	/* Pack the pile numers j into bytes p.
-		       j             j
-		+--------+----:----+--------+
-		|76543210|7654:3210|76543210|
-		+--------+----:----+--------+
-		    p         p         p
-	*/
+	/* Pack the pile numbers into the key. */
 
-        quint16 *p2 = ( quint16* ) p;
+	q = p + 1;
 	for (w = 0; w < m_number_piles; ++w) {
 		j = Wpilenum[w];
                 if ( j < 0 )
                 {
-                    mm->give_back_block( p );
+                    mm->give_back_key( p );
                     return NULL;
                 }
-                *p2++ = j;
+		while (j >= 0x80) {
+			*q++ = (j & 0x7F) | 0x80;
+			j >>= 7;
+		}
+		*q++ = j;
 	}
+	p[0] = q - p - 1;
+	mm->trim_key(p);
 
-	return node;
+	return p;
 }
 
-/* Like strcpy() but return the length of the string. */
+/* Rename the suits of each class in the order they first show up in the
+piles, going through the piles from the first one and every pile from the
+bottom: the first suit of a class to show up gets the lowest suit of the
+class, and so on.  perm[s] is what suit s becomes. */
 
-static inline int strecpy(unsigned char *d, unsigned char *s)
+void Solver::suit_perm(int *perm)
 {
-	int i;
+	int count[4];
+	int i, j, s, w, c, seen;
 
-	i = 0;
-	while ((*d++ = *s++) != '\0') {
-		i++;
+	for (s = 0; s < 4; ++s) {
+		perm[s] = Suitclass[s] < 0 ? s : -1;
+		count[s] = 0;
 	}
 
-	return i;
+	seen = 0;
+	for (w = 0; w < m_number_piles && seen < Nsymmetric; ++w) {
+		for (i = 0; i < Wlen[w] && seen < Nsymmetric; ++i) {
+			s = SUIT(W[w][i]);
+			if (perm[s] >= 0) {
+				continue;
+			}
+
+			/* The count[c]-th suit of class c. */
+
+			c = Suitclass[s];
+			for (j = 0, perm[s] = 0; j <= count[c]; ++perm[s]) {
+				if (Suitclass[perm[s]] == c) {
+					++j;
+				}
+			}
+			--perm[s];
+			++count[c];
+			++seen;
+		}
+	}
+	for (s = 0; s < 4; ++s) {
+		if (perm[s] < 0) {
+			c = Suitclass[s];
+			for (j = 0, perm[s] = 0; j <= count[c]; ++perm[s]) {
+				if (Suitclass[perm[s]] == c) {
+					++j;
+				}
+			}
+			--perm[s];
+			++count[c];
+		}
+	}
+}
+
+/* Packed positions that only differ by suits of a class swapped stand for
+the same game, so the store only needs one of them.  Return the key of the
+position with its suits renamed by suit_perm() (the key itself if no suit
+is), and in cluster, which has the cluster number of the position, that
+of the renamed one.  Any renaming would do, since only positions
+that can be made the same by swapping suits get the same key.  This one
+is undone by the renaming of the first position of the deal, Suitbase:
+the cards at the bottom of the piles seldom move, so most positions don't
+need any renaming at all. */
+
+quint8 *Solver::canonical_key(quint8 *key, unsigned int *cluster)
+{
+	int perm[4];
+	int i, j, s, w, len, id;
+	card_t cards[84], card;
+	bool renamed;
+	quint8 *q;
+
+	suit_perm(perm);
+	renamed = false;
+	for (s = 0; s < 4; ++s) {
+		perm[s] = Suitbase[perm[s]];
+		renamed |= perm[s] != s;
+	}
+	if (!renamed) {
+		return key;
+	}
+
+	/* Rename the suits pile by pile. */
+
+	for (w = 0; w < m_number_piles; ++w) {
+		len = Wlen[w];
+		id = Wpilenum[w];
+		for (i = 0; i < len; ++i) {
+			card = W[w][i];
+			s = SUIT(card);
+			if (perm[s] != s) {
+				break;
+			}
+		}
+		if (i < len) {
+			for (i = 0; i < len; ++i) {
+				card = W[w][i];
+				cards[i] = (card & ~PS_SUIT) | (perm[SUIT(card)] << 4);
+			}
+			id = piles()->find(cards, len, fnv_hash_buf(cards, len), &Pilestats);
+			if (id < 0) {
+				Status = UnableToDetermineSolvability;
+				return NULL;
+			}
+		}
+		Wcanonpile[suit_pile(w, perm)] = id;
+	}
+
+	q = Wcanon + 1;
+	for (w = 0; w < m_number_piles; ++w) {
+		j = Wcanonpile[w];
+		while (j >= 0x80) {
+			*q++ = (j & 0x7F) | 0x80;
+			j >>= 7;
+		}
+		*q++ = j;
+	}
+	Wcanon[0] = q - Wcanon - 1;
+	*cluster = suit_cluster(*cluster, perm);
+
+	return Wcanon;
+}
+
+void Solver::setSuitSymmetry( const int *classes )
+{
+    int size[4] = { 0, 0, 0, 0 };
+
+    for ( int s = 0; s < 4; ++s )
+    {
+        Suitclass[s] = classes[s];
+        if ( classes[s] >= 0 )
+            size[classes[s]]++;
+    }
+
+    /* A suit that is alone in its class can't be swapped. */
+    Nsymmetric = 0;
+    for ( int s = 0; s < 4; ++s )
+    {
+        if ( Suitclass[s] >= 0 && size[Suitclass[s]] < 2 )
+            Suitclass[s] = -1;
+        if ( Suitclass[s] >= 0 )
+            Nsymmetric++;
+    }
 }
 
 /* Unpack a compact position rep.  T cells must be restored from the
@@ -417,30 +564,46 @@ array following the POSITION struct. */
 
 void Solver::unpack_position(POSITION *pos)
 {
-	int i, w;
-	quint8 c;
-	BUCKETLIST *l;
+	int i, w, shift;
+	const PILE *l;
+	const quint8 *p;
+	PileTable *t = piles();
+
+	/* A position without a layout of its own is rebuilt from the
+	nearest ancestor that has one. */
+
+	if (pos->node == NULL) {
+		unpack_position(pos->parent);
+		make_move(&pos->move);
+		return;
+	}
 
         unpack_cluster(pos->cluster);
 
-	/* Unpack bytes p into pile numbers j.
-		    p         p         p
-		+--------+----:----+--------+
-		|76543210|7654:3210|76543210|
-		+--------+----:----+--------+
-		       j             j
-	*/
+	/* Unpack the pile numbers from the key. */
 
-	w = i = c = 0;
-	quint16 *p2 = ( quint16* )( (quint8 *)(pos->node) + sizeof(TREE) );
+	w = 0;
+	p = pos->node + 1;
 	while (w < m_number_piles) {
-                i = *p2++;
-		Wpilenum[w] = i;
-		l = Pilebucket[i];
-		i = strecpy(W[w], l->pile);
-		Wp[w] = &W[w][i - 1];
-		Wlen[w] = i;
-		Whash[w] = l->hash;
+		i = shift = 0;
+		do {
+			i |= (*p & 0x7F) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+
+		/* A pile keeps its id until it changes, so if it has this
+		one, the cards are already there. */
+
+		if (Wpilenum[w] != i) {
+			Wpilenum[w] = i;
+			l = t->pile(i);
+			t->unpack(l, W[w]);
+			W[w][l->len] = 0;
+			Wp[w] = &W[w][l->len - 1];
+			Wlen[w] = l->len;
+			Whash[w] = l->hash;
+			Wset[w] = l->set;
+		}
 		w++;
 	}
 }
@@ -479,7 +642,7 @@ void Solver::win(POSITION *pos)
 
     //printf("Winning in %d moves.\n", nmoves);
 
-    mpp0 = new_array(MOVE *, nmoves);
+    mpp0 = new_array(mm, MOVE *, nmoves);
     if (mpp0 == NULL) {
         Status = UnableToDetermineSolvability;
         return; /* how sad, so close... */
@@ -492,7 +655,53 @@ void Solver::win(POSITION *pos)
     for (i = 0, mpp = mpp0; i < nmoves; ++i, ++mpp)
         winMoves.append( **mpp );
 
-    MemoryManager::free_array(mpp0, nmoves);
+    mm->free_array(mpp0, nmoves);
+
+    /* Remember the positions along the way for the next search.  The
+       ones without a layout of their own can't be recognized. */
+
+    if (m_incremental && max_positions == -1) {
+        Winkeys.clear();
+        for (p = pos; p; p = p->parent) {
+            Winkeys.prepend(p->node ? QByteArray((const char *)p->node, key_length(p->node))
+                                    : QByteArray());
+        }
+        Winline = winMoves;
+    }
+}
+
+/* The same for the best position so far.  The line is short and this
+happens seldom, so there's no need to count the moves first. */
+
+void Solver::best(POSITION *pos)
+{
+    POSITION *p;
+
+    bestMoves.clear();
+    for (p = pos; p->parent; p = p->parent)
+        bestMoves.prepend(p->move);
+}
+
+/* See whether the search has to stop, because somebody told it to, its
+time is up or it has taken all the memory it may.  The clock and the
+memory are only looked at if clock is set, which the callers do every so
+often. */
+
+bool Solver::interrupted(bool clock)
+{
+	if (m_shouldEnd.load()) {
+		Status = SearchAborted;
+		return true;
+	}
+	if (clock && m_time_limit >= 0 && m_clock.elapsed() > m_time_limit) {
+		Status = TimeLimitReached;
+		return true;
+	}
+	if (clock && m_memory_limit && memory_in_use() > m_memory_limit) {
+		Status = UnableToDetermineSolvability;
+		return true;
+	}
+	return false;
 }
 
 /* Initialize the hash buckets. */
@@ -501,28 +710,29 @@ void Solver::init_buckets(void)
 {
 	int i;
 
-	/* Packed positions need 3 bytes for every 2 piles. */
+	/* Packed positions need up to 5 bytes for every pile, and one for
+	the length. */
 
-	i = ( m_number_piles ) * sizeof( quint16 );
-	i += ( m_number_piles ) & 0x1;
+	i = 1 + ( m_number_piles ) * 5;
+	Q_ASSERT( i <= 256 );
 
         mm->Pilebytes = i;
-
-	memset(Bucketlist, 0, sizeof(Bucketlist));
-	Pilenum = 0;
-	Treebytes = sizeof(TREE) + mm->Pilebytes;
+	if (mm->Storemode == MemoryManager::TREE_STORE) {
+		i += sizeof(TREE);
+	}
 
 	/* In order to keep the TREE structure aligned, we need to add
 	up to 7 bytes on Alpha or 3 bytes on Intel -- but this is still
 	better than storing the TREE nodes and keys separately, as that
-	requires a pointer.  On Intel for -f Treebytes winds up being
-	a multiple of 8 currently anyway so it doesn't matter. */
+	requires a pointer.  This is only what new_key() hands out, the
+	key gets trimmed to its real size once it's packed. */
 
 #define ALIGN_BITS 0x7
-	if (Treebytes & ALIGN_BITS) {
-		Treebytes |= ALIGN_BITS;
-		Treebytes++;
+	if (i & ALIGN_BITS) {
+		i |= ALIGN_BITS;
+		i++;
 	}
+	mm->Keybytes = i;
 	Posbytes = sizeof(POSITION);
 	if (Posbytes & ALIGN_BITS) {
 		Posbytes |= ALIGN_BITS;
@@ -533,96 +743,33 @@ void Solver::init_buckets(void)
 
 /* For each pile, return a unique identifier.  Although there are a
 large number of possible piles, generally fewer than 1000 different
-piles appear in any given game.  We'll use the pile's hash to find
-a hash bucket that contains a short list of piles, along with their
-identifiers. */
+piles appear in any given game.  They are kept in a hash table of their
+own, shared with the other workers of a parallel search. */
 
 int Solver::get_pilenum(int w)
 {
-	int bucket, pilenum;
-	BUCKETLIST *l, *last;
-
-	/* For a given pile, get its unique pile id.  If it doesn't have
-	one, add it to the appropriate list and give it one.  First, get
-	the hash bucket. */
-
-	bucket = Whash[w] % NBUCKETS;
-
-	/* Look for the pile in this bucket. */
-
-	last = NULL;
-	for (l = Bucketlist[bucket]; l; l = l->next) {
-		if (l->hash == Whash[w] &&
-		    strncmp((char*)l->pile, (char*)W[w], Wlen[w]) == 0) {
-			break;
-		}
-		last = l;
-	}
-
-	/* If we didn't find it, make a new one and add it to the list. */
-
-	if (l == NULL) {
-		if (Pilenum >= NPILES ) {
-                        Status = UnableToDetermineSolvability;
-			//qDebug() << "out of piles";
-			return -1;
-		}
-		l = mm_allocate(BUCKETLIST);
-		if (l == NULL) {
-                        Status = UnableToDetermineSolvability;
-			//qDebug() << "out of buckets";
-			return -1;
-		}
-		l->pile = new_array(quint8, Wlen[w] + 1);
-		if (l->pile == NULL) {
-                    Status = UnableToDetermineSolvability;
-                    MemoryManager::free_ptr(l);
-		    //qDebug() << "out of memory";
-                    return -1;
-		}
-
-		/* Store the new pile along with its hash.  Maintain
-		a reverse mapping so we can unpack the piles swiftly. */
+	int pilenum;
 
-		strncpy((char*)l->pile, (char*)W[w], Wlen[w] + 1);
-		l->hash = Whash[w];
-		l->pilenum = pilenum = Pilenum++;
-		l->next = NULL;
-		if (last == NULL) {
-			Bucketlist[bucket] = l;
-		} else {
-			last->next = l;
-		}
-		Pilebucket[pilenum] = l;
+	pilenum = piles()->find(W[w], Wlen[w], Whash[w], &Pilestats);
+	if (pilenum < 0) {
+		Status = UnableToDetermineSolvability;
 	}
 
 #if 0
 if (w < 4) {
-        fprintf( stderr, "get_pile_num %d ", l->pilenum );
+        fprintf( stderr, "get_pile_num %d ", pilenum );
         for (int i = 0; i < Wlen[w]; ++i) {
             printcard(W[w][i], stderr);
         }
         fprintf( stderr, "\n" );
 }
 #endif
-	return l->pilenum;
+	return pilenum;
 }
 
 void Solver::free_buckets(void)
 {
-	int i, j;
-	BUCKETLIST *l, *n;
-
-	for (i = 0; i < NBUCKETS; i++) {
-		l = Bucketlist[i];
-		while (l) {
-			n = l->next;
-			j = strlen((char*)l->pile);    /* @@@ use block? */
-                        MemoryManager::free_array(l->pile, j + 1);
-                        MemoryManager::free_ptr(l);
-			l = n;
-		}
-	}
+	Piles->clear();
 }
 
 /* Solve patience games.  Prioritized breadth-first search.  Simple breadth-
@@ -631,7 +778,7 @@ priority to positions with more cards out, so the solution found is not
 guaranteed to be the shortest, but it'll be better than with a depth-first
 search. */
 
-void Solver::doit()
+void Solver::doit(MemoryManager *kept)
 {
 	int i, q;
 	POSITION *pos;
@@ -640,26 +787,41 @@ void Solver::doit()
 
 	/* Init the queues. */
 
+	Queue->clear();
 	for (i = 0; i < NQUEUES; ++i) {
-		Qhead[i] = NULL;
+		Stats.queued[i] = 0;
 	}
-	Maxq = 0;
 
 	/* Queue the initial position to get started. */
 
 	hash_layout();
 	pilesort();
+	if (known_position(kept)) {
+		return;
+	}
 	m.card_index = -1;
         m.turn_index = -1;
-	pos = new_position(NULL, &m);
+	pos = new_position(NULL, &m, getClusterNumber());
 	if ( pos == NULL )
         {
             Status = UnableToDetermineSolvability;
             return;
         }
-	queue_position(pos, 0);
+	queue_position(pos, 0, getOuts());
+
+	/* Solve it.  A parallel search expands the first position before
+	the other workers join in, so that firstMoves is ours. */
 
-	/* Solve it. */
+	if (mm->Locked) {
+		pos = dequeue_position();
+		if (!solve(pos)) {
+			free_position(pos, true);
+		}
+		if (Status == NoSolutionExists && start_workers()) {
+			work();
+			stop_workers();
+		}
+	}
 
         while ((pos = dequeue_position()) != NULL) {
 		q = solve(pos);
@@ -669,103 +831,293 @@ void Solver::doit()
 	}
 }
 
-/* Generate all the successors to a position and either queue them or
-recursively solve them.  Return whether any of the child nodes, or their
-descendents, were queued or not (if not, the position can be freed). */
+/* See if an earlier search found out about this position already, see
+setIncremental().  If so, that's the answer, and all that's left to do is
+to list the first moves. */
 
-bool Solver::solve(POSITION *parent)
+bool Solver::known_position(MemoryManager *kept)
 {
-	int i, nmoves, qq;
-	MOVE *mp, *mp0;
-	POSITION *pos;
+	int i, nmoves;
+	quint8 *key;
+	MOVE *mp0;
 
-        bool q;
-        all_moves++;
+	if (Kept == UnableToDetermineSolvability) {
+		return false;
+	}
+	if ((key = pack_position()) == NULL) {
+		return false;
+	}
 
-	/* If we've won already (or failed), we just go through the motions
-	but always return false from any position.  This enables the cleanup
-	of the move stack and eventual destruction of the position store. */
+	i = -1;
+	if (Kept == SolutionExists) {
+		i = Winkeys.indexOf(QByteArray((const char *)key, key_length(key)));
+		if (i >= 0) {
+			winMoves = Winline.mid(i);
+		}
+	} else {
+		unsigned int k = getClusterNumber();
+		quint8 *ckey = Nsymmetric ? canonical_key(key, &k) : key;
+		if (ckey && kept->find_key(ckey, k, m_checkpoint > 1)) {
+			i = 0;
+		}
+	}
+	mm->give_back_key(key);
+	if (i < 0) {
+		return false;
+	}
+
+	Status = Kept;
+	if ((mp0 = get_moves(&nmoves)) != NULL) {
+		for (i = 0; i < nmoves; ++i) {
+			firstMoves.append(Possible[i]);
+		}
+		mm->free_array(mp0, nmoves);
+	}
+	if (m_listener) {
+		m_listener->firstMovesFound(firstMoves);
+	}
+
+	return true;
+}
+
+/* After a search that wasn't cut short by a position limit, decide what
+the next one can start from. */
+
+void Solver::keep_positions(void)
+{
+	if (!m_incremental || mm->Storemode != MemoryManager::HASH_STORE) {
+		Kept = UnableToDetermineSolvability;
+	} else if (Status == NoSolutionExists || Status == SolutionExists) {
+		Kept = Status;
+	} else if (Kept == NoSolutionExists) {
+
+		/* The store has other positions now, too. */
+
+		Kept = UnableToDetermineSolvability;
+	}
+
+	/* A winning line stays good until something else is kept. */
+
+	if (Kept != SolutionExists) {
+		Winkeys.clear();
+		Winline.clear();
+	}
+}
+
+/* Count a position solve() is about to expand, and tell whether the search
+goes on.  If we've won already (or failed), we just go through the motions
+but always return false from any position.  This enables the cleanup of
+the move stack and eventual destruction of the position store. */
+
+bool Solver::may_expand(void)
+{
+        ++Stats.expanded;
 
 	if (Status != NoSolutionExists) {
 		return false;
 	}
+	if (m_pool && m_pool->stop.load()) {
+		return false;
+	}
+	if (interrupted((Stats.expanded & 0x3F) == 0)) {
+		return false;
+	}
 
-        {
-            QMutexLocker lock( &endMutex );
-            if ( m_shouldEnd )
-            {
-                Status = SearchAborted;
-                return false;
-            }
-        }
-
-        if ( max_positions != -1 && Total_positions > ( unsigned long )max_positions )
+        unsigned long positions = m_pool ? m_pool->positions.load() : Stats.positions;
+        if ( max_positions != -1 && positions > ( unsigned long )max_positions )
         {
             Status = MemoryLimitReached;
             return false;
         }
 
+	return true;
+}
 
-	/* Generate an array of all the moves we can make. */
+/* One of the moves from parent led nowhere new. */
 
-	if ((mp0 = get_moves(&nmoves)) == NULL) {
-            if ( isWon() ) {
-                Status = SolutionExists;
-                win( parent );
-            }
-            return false;
+void Solver::drop_child(POSITION *parent)
+{
+	QMutexLocker lock(m_pool ? &m_pool->treeMutex : NULL);
+	parent->nchild--;
+}
+
+/* Let go of the hold a parallel search keeps on parent while solve()
+expands it, and return whether the position needs to be kept around. */
+
+bool Solver::let_go(POSITION *parent, bool keep)
+{
+	if (m_pool) {
+		QMutexLocker lock(&m_pool->treeMutex);
+		if (--parent->nchild == 0) {
+			keep = false;
+		}
 	}
+	return keep;
+}
 
-        if ( parent->depth == 0 )
-        {
-            Q_ASSERT( firstMoves.count() == 0 );
-            for (int j = 0; j < nmoves; ++j)
-                firstMoves.append( Possible[j] );
-        }
+/* Depth-first search with iterative deepening on a budget of moves: every
+iteration searches the moves depth first, best first, and gives up on a
+line once it has made more moves than the bound allows.  Moves that take
+a card out are free, only the others count against the bound.  Raising
+the bound by one at a time would search the positions near the start over
+and over, and a tight bound makes the search go through all the ways to
+waste the last few moves of the budget, so the first bound is a generous
+one, and every iteration allows four times as many moves.  The
+transposition table keeps the budget each position was searched with in
+this iteration, which cuts off the positions seen before and the cycles,
+and whether the position can't be won at all, which stays good for the
+next iterations.  An iteration that never hit the bound saw everything
+there is, so if it didn't win, the game is lost -- unless two positions
+had the same print in the table, which is why patsolve() checks it with
+exact keys.  The memory needed is the table and the line of moves,
+however long the search takes. */
+
+#define DFS_TABLESIZE (16 * 1024 * 1024)
+#define DFS_FIRSTBOUND 256
+#define DFS_MAXBOUND 4096
+
+void Solver::depth_first(MemoryManager *kept)
+{
+	quint64 print;
+	TTENTRY *e;
+	int bound;
+	bool lost, ok;
 
-	parent->nchild = nmoves;
+	hash_layout();
+	pilesort();
+	if (known_position(kept) || Status != NoSolutionExists) {
+		return;
+	}
+
+	/* Leave some of the memory to the piles and the moves. */
 
-	/* Make each move and either solve or queue the result. */
+	{
+		QMutexLocker lock(&statsMutex);
+		size_t size = qMin<size_t>(DFS_TABLESIZE, MemoryManager::Mem_remain / 2);
+		if (m_memory_limit) {
+			size = qMin(size, m_memory_limit / 2);
+		}
+		ok = Table.init(size);
+	}
+	if (!ok) {
+		Status = UnableToDetermineSolvability;
+		return;
+	}
+
+	print = position_print(getClusterNumber());
+	Startpositions = Stats.positions;
+	bound = DFS_FIRSTBOUND;
+	for (Iteration = 1; Status == NoSolutionExists; ++Iteration, bound *= 4) {
+		if (bound > DFS_MAXBOUND) {
+			Status = UnableToDetermineSolvability;
+			break;
+		}
+		Cut = false;
+		Line.clear();
+		e = Table.store(print, Iteration);
+		e->budget = bound;
+		e->iteration = Iteration;
+		e->onpath = 1;
+		if (dfs(0, bound, &lost) || Status != NoSolutionExists) {
+			break;
+		}
+		if ((e = Table.find(print)) != NULL) {
+			e->onpath = 0;
+		}
+		if (lost || !Cut) {
+			break;
+		}
+	}
+	Line.clear();
+}
 
-	q = false;
-	for (i = 0, mp = mp0; i < nmoves; ++i, ++mp) {
-		make_move(mp);
+/* Remember the start position, for restart(). */
 
-		/* Calculate indices for the new piles. */
+bool Solver::save_start(void)
+{
+	quint8 *key;
 
-		pilesort();
+	hash_layout();
+	pilesort();
+	if ((key = pack_position()) == NULL) {
+		return false;
+	}
+	Startkey = QByteArray((const char *)key, key_length(key));
+	Startcluster = getClusterNumber();
+	mm->give_back_key(key);
+	return true;
+}
 
-		/* See if this is a new position. */
+/* Drop the positions of a best-first search that gave up, and go back to
+the start position for a depth-first one.  The kept positions, if any, go
+with them. */
 
-		if ((pos = new_position(parent, mp)) == NULL) {
-			undo_move(mp);
-			parent->nchild--;
-			continue;
+void Solver::restart(MemoryManager *kept)
+{
+	POSITION pos;
+
+	{
+		QMutexLocker lock(&statsMutex);
+		Mem_used = qMax<size_t>(Mem_used, peak_memory());
+		mm->free_clusters();
+		mm->free_blocks();
+		foreach (Solver *w, m_workers) {
+			w->mm->free_blocks();
+			w->mm->reset_peak();
 		}
+		mm->init_blocks();
+		mm->init_clusters();
+		mm->reset_peak();
+	}
+	if (mm == kept) {
+		Kept = UnableToDetermineSolvability;
+		Winkeys.clear();
+		Winline.clear();
+	}
 
-		/* If this position is in a new cluster, a card went out.
-		Don't queue it, just keep going.  A larger cutoff can also
-		force a recursive call, which can help speed things up (but
-		reduces the quality of solutions).  Otherwise, save it for
-		later. */
-
-		if (pos->cluster != parent->cluster || !nmoves) {
-			qq = solve(pos);
-			undo_move(mp);
-			if (!qq) {
-				free_position(pos, false);
+	memset(&pos, 0, sizeof(POSITION));
+	pos.node = (quint8 *)Startkey.data();
+	pos.cluster = Startcluster;
+	unpack_position(&pos);
+	Startkey.clear();
+	Status = NoSolutionExists;
+}
+
+/* A 64 bit hash of the current position, made of the pile ids the way
+pack_position() packs them, and its cluster k.  With suit symmetry, it's
+the hash of the canonical key. */
+
+quint64 Solver::position_print(unsigned int k)
+{
+	int j, w;
+	quint64 h;
+	quint8 *key, *ckey;
+
+	h = FNV1_64_INIT;
+	if (Nsymmetric) {
+		if ((key = pack_position()) == NULL) {
+			return 1;
+		}
+		if ((ckey = canonical_key(key, &k)) != NULL) {
+			h = key_print(ckey);
+		}
+		mm->give_back_key(key);
+	} else {
+		for (w = 0; w < m_number_piles; ++w) {
+			j = Wpilenum[w];
+			while (j >= 0x80) {
+				h = (h ^ ((j & 0x7F) | 0x80)) * FNV_64_PRIME;
+				j >>= 7;
 			}
-			q |= (bool)qq;
-		} else {
-			queue_position(pos, mp->pri);
-			undo_move(mp);
-			q = true;
+			h = (h ^ j) * FNV_64_PRIME;
 		}
 	}
-        MemoryManager::free_array(mp0, nmoves);
+	for (w = 0; w < 4; ++w) {
+		h = (h ^ (k & 0xFF)) * FNV_64_PRIME;
+		k >>= 8;
+	}
 
-	/* Return true if this position needs to be kept around. */
-	return q;
+	return h | 1;                   /* never 0 */
 }
 
 /* We can't free the stored piles in the trees, but we can free some of the
@@ -777,18 +1129,20 @@ recursively (rec == true). */
 
 void Solver::free_position(POSITION *pos, int rec)
 {
-    /* We don't really free anything here, we just push it onto a
-       freelist (using the queue member), so we can use it again later. */
+    POSITION *parent;
 
+    /* We don't really free anything here, we just give it back to the
+       arena, so we can use it again later. */
+
+    QMutexLocker lock(m_pool ? &m_pool->treeMutex : NULL);
     if (!rec) {
-        pos->queue = Freepos;
-        Freepos = pos;
         pos->parent->nchild--;
+        mm->give_back_slab(pos, Posbytes);
     } else {
         do {
-            pos->queue = Freepos;
-            Freepos = pos;
-            pos = pos->parent;
+            parent = pos->parent;
+            mm->give_back_slab(pos, Posbytes);
+            pos = parent;
             if (pos == NULL) {
                 return;
             }
@@ -798,17 +1152,17 @@ void Solver::free_position(POSITION *pos, int rec)
 }
 
 /* Save positions for consideration later.  pri is the priority of the move
-that got us here.  The work queue is kept sorted by priority (simply by
-having separate queues). */
+that got us here, nout the cards out in the position.  The work queue is
+kept sorted by priority (simply by having separate queues). */
 
-void Solver::queue_position(POSITION *pos, int pri)
+void Solver::queue_position(POSITION *pos, int pri, int nout)
 {
+	PhaseTimer timer(m_timing, Stats.queue_ns);
+
 	/* In addition to the priority of a move, a position gets an
 	additional priority depending on the number of cards out.  We use a
 	"queue squashing function" to map nout to priority.  */
 
-        int nout = getOuts();
-
         static qreal Yparam[] = { 0.0032, 0.32, -3.0 };
 	qreal x = (Yparam[0] * nout + Yparam[1]) * nout + Yparam[2];
 	pri += (int)floor(x + .5);
@@ -818,20 +1172,21 @@ void Solver::queue_position(POSITION *pos, int pri)
 	} else if (pri >= NQUEUES) {
 		pri = NQUEUES - 1;
 	}
-	if (pri > Maxq) {
-		Maxq = pri;
+
+	{
+		QMutexLocker lock(m_pool ? &queueMutex : NULL);
+		Queue->push(pos, pri);
+		++Stats.queued[pri];
+		++Stats.enqueued;
 	}
 
-	/* We always dequeue from the head.  Here we either stick the move
-	at the head or tail of the queue, depending on whether we're
-	pretending it's a stack or a queue. */
+	/* Wake a worker that has nothing to do.  One that went idle since
+	the push will find the position itself: it looks in our queues after
+	counting itself idle, and before it sleeps. */
 
-	pos->queue = NULL;
-	if (Qhead[pri] == NULL) {
-		Qhead[pri] = pos;
-	} else {
-            pos->queue = Qhead[pri];
-            Qhead[pri] = pos;
+	if (m_pool && m_pool->idle.loadAcquire() > 0) {
+		QMutexLocker lock(&m_pool->idleMutex);
+		m_pool->wakeup.wakeOne();
 	}
 }
 
@@ -839,60 +1194,231 @@ void Solver::queue_position(POSITION *pos, int pri)
 
 POSITION *Solver::dequeue_position()
 {
-	int last;
+	PhaseTimer timer(m_timing, Stats.queue_ns);
 	POSITION *pos;
-	static int qpos = 0;
-	static int minpos = 0;
-
-	/* This is a kind of prioritized round robin.  We make sweeps
-	through the queues, starting at the highest priority and
-	working downwards; each time through the sweeps get longer.
-	That way the highest priority queues get serviced the most,
-	but we still get lots of low priority action (instead of
-	ignoring it completely). */
-
-	last = false;
-	do {
-		qpos--;
-		if (qpos < minpos) {
-			if (last) {
-				return NULL;
+
+	{
+		QMutexLocker lock(m_pool ? &queueMutex : NULL);
+		pos = take_position();
+	}
+
+	/* Unpack the position into the work arrays. */
+
+	if (pos) {
+		unpack_position(pos);
+	}
+
+	return pos;
+}
+
+/* Take the next position off the queues, without unpacking it. */
+
+POSITION *Solver::take_position(void)
+{
+	int pri, scans;
+	POSITION *pos;
+
+	pos = Queue->pop(&pri, &scans);
+	Stats.qscans += scans;
+	if (pos) {
+		--Stats.queued[pri];
+		++Stats.dequeued;
+	}
+
+	return pos;
+}
+
+/* Steal a position from the queues of another worker, trying them in turn,
+and unpack it into our work arrays. */
+
+POSITION *Solver::steal_position(void)
+{
+	int i, n, self;
+	Solver *victim;
+	POSITION *pos;
+
+	n = m_pool->workers.count();
+	self = m_pool->workers.indexOf(this);
+	for (i = 1; i < n; i++) {
+		victim = m_pool->workers[(self + i) % n];
+		{
+			QMutexLocker lock(&victim->queueMutex);
+			pos = victim->take_position();
+		}
+		if (pos) {
+			unpack_position(pos);
+			return pos;
+		}
+	}
+
+	return NULL;
+}
+
+/* Start the workers of a parallel search.  They begin with empty queues
+and steal their first positions from ours. */
+
+bool Solver::start_workers(void)
+{
+	int i;
+	Solver *w;
+
+	if (m_workers.count() == 0) {
+		return false;
+	}
+
+	m_pool = new SolverPool;
+	m_pool->positions.store(Stats.positions);
+	m_pool->workers.append(this);
+	foreach (w, m_workers) {
+		w->mm->Pilebytes = mm->Pilebytes;
+		w->mm->Keybytes = mm->Keybytes;
+		w->mm->Storemode = mm->Storemode;
+		if (Kept != NoSolutionExists) {
+			w->mm->init_blocks();
+		}
+		w->mm->reset_peak();
+		w->max_positions = max_positions;
+		w->debug = false;
+		w->Status = NoSolutionExists;
+		w->Stats = SOLVERSTATS();
+		memset(&w->Pilestats, 0, sizeof(PILESTATS));
+		w->winMoves.clear();
+		w->firstMoves.clear();
+		w->bestMoves.clear();
+		w->Queue->clear();
+		for (i = 0; i < m_number_piles; ++i) {
+			w->Wpilenum[i] = -1;
+		}
+		w->m_pool = m_pool;
+		m_pool->workers.append(w);
+	}
+	foreach (w, m_workers) {
+		QThread *thread = new SolverWorker(w);
+		m_pool->threads.append(thread);
+		thread->start();
+	}
+
+	return true;
+}
+
+/* The main loop of every worker (including the one that started the
+search, which runs it on its own thread). */
+
+void Solver::work(void)
+{
+	POSITION *pos;
+	bool idle = false;
+
+	while (!m_pool->stop.load()) {
+		pos = dequeue_position();
+		if (pos == NULL) {
+			pos = steal_position();
+		}
+		if (pos == NULL) {
+			if (interrupted(true)) {
+				m_pool->halt();
+				break;
 			}
-			qpos = Maxq;
-			minpos--;
-			if (minpos < 0) {
-				minpos = Maxq;
+
+			/* Only a worker with positions in its queues can
+			add new ones, so once everyone is idle, we're done. */
+
+			QMutexLocker lock(&m_pool->idleMutex);
+			if (!idle) {
+				idle = true;
+				m_pool->idle.ref();
 			}
-			if (minpos == 0) {
-				last = true;
+			if (m_pool->idle.loadAcquire() == m_pool->workers.count()) {
+				m_pool->wakeup.wakeAll();
+				break;
 			}
+
+			/* Look once more, now that whoever queues a position
+			knows to wake us, and sleep if there's still nothing. */
+
+			pos = steal_position();
+			if (pos == NULL) {
+				if (!m_pool->stop.load()) {
+					m_pool->wakeup.wait(&m_pool->idleMutex);
+				}
+				continue;
+			}
+		}
+		if (idle) {
+			idle = false;
+			m_pool->idle.deref();
+		}
+
+		if (!solve(pos)) {
+			free_position(pos, true);
+		}
+
+		if (Status != NoSolutionExists) {
+			{
+				QMutexLocker lock(&m_pool->winMutex);
+				if (Status == SolutionExists && m_pool->winner == NULL) {
+					m_pool->winner = this;
+				}
+			}
+			m_pool->halt();
 		}
-	} while (Qhead[qpos] == NULL);
+	}
+}
 
-	pos = Qhead[qpos];
-	Qhead[qpos] = pos->queue;
+/* Wait for the workers and collect their results. */
 
-	/* Decrease Maxq if that queue emptied. */
+void Solver::stop_workers(void)
+{
+	Solver *w;
 
-	while (Qhead[qpos] == NULL && qpos == Maxq && Maxq > 0) {
-		Maxq--;
-		qpos--;
-		if (qpos < minpos) {
-			minpos = qpos;
+	foreach (QThread *thread, m_pool->threads) {
+		thread->wait();
+		delete thread;
+	}
+
+	QMutexLocker lock(&statsMutex);
+	foreach (w, m_workers) {
+		if (w->Stats.bestouts > Stats.bestouts) {
+			bestMoves = w->bestMoves;
+		}
+		add_stats(&Stats, w->Stats);
+		w->Stats = SOLVERSTATS();
+		Pilestats.lookups += w->Pilestats.lookups;
+		Pilestats.probes += w->Pilestats.probes;
+		Pilestats.maxprobe = qMax(Pilestats.maxprobe, w->Pilestats.maxprobe);
+		if (Status == NoSolutionExists && w->Status != SolutionExists) {
+			Status = w->Status;
 		}
+		w->m_pool = NULL;
+	}
+	if (m_pool->winner && m_pool->winner != this) {
+		Status = SolutionExists;
+		winMoves = m_pool->winner->winMoves;
+		Winkeys = m_pool->winner->Winkeys;
+		Winline = m_pool->winner->Winline;
 	}
 
-	/* Unpack the position into the work arrays. */
+	delete m_pool;
+	m_pool = NULL;
+}
 
-	unpack_position(pos);
+/* Positions go into the store of the solver that started the search. */
 
-	return pos;
+MemoryManager *Solver::store(void) const
+{
+	return m_pool ? m_pool->workers.first()->mm : mm;
+}
+
+/* And so do the piles. */
+
+PileTable *Solver::piles(void) const
+{
+	return m_pool ? m_pool->workers.first()->Piles : Piles;
 }
 
 Solver::Solver()
 {
     mm = new MemoryManager();
-    Freepos = NULL;
     m_newer_piles_first = true;
     /* Work arrays. */
     W = 0;
@@ -902,11 +1428,79 @@ Solver::Solver()
 
     Whash = 0;
     Wpilenum = 0;
+    Piles = new PileTable();
+    memset( &Pilestats, 0, sizeof( PILESTATS ) );
+    Wprefix = 0;
+    Wprefixset = 0;
+    Wseen = 0;
+    Wseenlen = 0;
+    Wset = 0;
+    Wcanonpile = 0;
+    Wcanon = 0;
+    for ( int s = 0; s < 4; ++s )
+    {
+        Suitclass[s] = -1;
+        Suitbase[s] = s;
+    }
+    Nsymmetric = 0;
+    Stack = 0;
+
+    Mem_used = 0;
+    Queue = new RoundRobinFrontier();
+    m_queue_policy = RoundRobinQueues;
+    m_threads = 1;
+    m_time_limit = -1;
+    m_memory_limit = 0;
+    m_engine = BestFirstEngine;
+    m_timing = false;
+    m_searching = false;
+    m_checkpoint = 1;
+    m_incremental = false;
+    Kept = UnableToDetermineSolvability;
+    m_listener = NULL;
+    m_pool = NULL;
+}
+
+/* Copy the rules and the size of the layout for a worker of a parallel
+search.  Everything else is set up by start_workers(). */
+
+Solver::Solver( const Solver &other )
+{
+    mm = new MemoryManager();
+    Piles = new PileTable();
+    Piles->setRuns( other.Piles->runs() );
+    memset( &Pilestats, 0, sizeof( PILESTATS ) );
+    m_newer_piles_first = other.m_newer_piles_first;
+    memcpy( Suitclass, other.Suitclass, sizeof( Suitclass ) );
+    memcpy( Suitbase, other.Suitbase, sizeof( Suitbase ) );
+    Nsymmetric = other.Nsymmetric;
     Stack = 0;
+    m_shouldEnd.store( 0 );
+
+    Mem_used = 0;
+    Queue = 0;
+    setQueuePolicy( other.m_queue_policy );
+    m_threads = 1;
+    m_time_limit = -1;        /* the first worker keeps the time */
+    m_memory_limit = 0;       /* and counts the memory of all */
+    m_engine = other.m_engine;
+    m_timing = other.m_timing;
+    m_searching = false;
+    m_checkpoint = other.m_checkpoint;
+    m_incremental = other.m_incremental;
+    Kept = UnableToDetermineSolvability;
+    m_listener = NULL;
+    m_pool = NULL;
+
+    setNumberPiles( other.m_number_piles );
 }
 
 Solver::~Solver()
 {
+    forgetPositions();
+    qDeleteAll( m_workers );
+    delete Queue;
+    delete Piles;
     delete mm;
 
     for ( int i = 0; i < m_number_piles; ++i )
@@ -919,13 +1513,81 @@ Solver::~Solver()
     delete [] Wlen;
     delete [] Whash;
     delete [] Wpilenum;
+
+    for ( int i = 0; i < m_number_piles; ++i )
+    {
+        delete [] Wseen[i];
+        delete [] Wprefix[i];
+        delete [] Wprefixset[i];
+    }
+    delete [] Wseen;
+    delete [] Wseenlen;
+    delete [] Wprefix;
+    delete [] Wprefixset;
+    delete [] Wset;
+    delete [] Wcanonpile;
+    delete [] Wcanon;
 }
 
-void Solver::init()
+void Solver::init(MemoryManager *kept)
 {
-    m_shouldEnd = false;
+    m_shouldEnd.store( 0 );
+    bestMoves.clear();
+
+    if ( Kept == NoSolutionExists )
+    {
+        /* Go on with the kept store, and the workers, whose blocks hold
+           some of its positions.  A probe with a store of its own (see
+           patsolve()) does without them. */
+
+        if ( mm != kept )
+        {
+            mm->Segbits = 0;
+            mm->Locked = false;
+        }
+    }
+    else
+    {
+        /* A parallel search needs a fresh copy of the solver for every
+           other thread, and a store that can take concurrent inserts. */
+
+        QMutexLocker lock( &statsMutex );
+
+        /* The store is new, so the positions it gets can be renamed
+           from this one, see canonical_key(). */
+        int perm[4];
+        suit_perm( perm );
+        for ( int s = 0; s < 4; ++s )
+            Suitbase[perm[s]] = s;
+
+        qDeleteAll( m_workers );
+        m_workers.clear();
+        bool small = max_positions != -1 && max_positions < POOL_POSITIONS;
+        if ( m_threads > 1 && !small && mm->Storemode == MemoryManager::HASH_STORE )
+        {
+            for ( int i = 1; i < m_threads; ++i )
+            {
+                Solver *w = clone();
+                if ( !w )
+                    break;
+                m_workers.append( w );
+            }
+            if ( m_workers.count() < m_threads - 1 )
+            {
+                qDeleteAll( m_workers );
+                m_workers.clear();
+            }
+        }
+        mm->Segbits = m_workers.isEmpty() ? 0 : POOL_SEGBITS;
+        mm->Locked = !m_workers.isEmpty();
+    }
+
     init_buckets();
-    mm->init_clusters();
+    if ( Kept != NoSolutionExists || mm != kept )
+    {
+        mm->init_blocks();
+        mm->init_clusters();
+    }
 
     winMoves.clear();
     firstMoves.clear();
@@ -933,17 +1595,23 @@ void Solver::init()
     /* Reset stats. */
 
     Status = NoSolutionExists;
-    Total_positions = 0;
-    Total_generated = 0;
-    depth_sum = 0;
+    Stats = SOLVERSTATS();
+    memset( &Pilestats, 0, sizeof( PILESTATS ) );
 }
 
 void Solver::free()
 {
-    free_buckets();
-    mm->free_clusters();
-    mm->free_blocks();
-    Freepos = NULL;
+    /* The kept positions live in the store and refer to the piles. */
+
+    if ( Kept != NoSolutionExists )
+    {
+        mm->free_clusters();
+        mm->free_blocks();
+        foreach ( Solver *w, m_workers )
+            w->mm->free_blocks();
+    }
+    if ( Kept == UnableToDetermineSolvability )
+        free_buckets();
 }
 
 
@@ -951,23 +1619,107 @@ Solver::ExitStatus Solver::patsolve( int _max_positions, bool _debug )
 {
     max_positions = _max_positions;
     debug = _debug;
+    m_clock.start();
+
+    /* A search with a position limit is only a quick look.  It may
+       answer from the kept positions, but otherwise leaves them alone,
+       with a store of its own. */
+    MemoryManager *kept = mm;
+    {
+        QMutexLocker lock( &statsMutex );
+        if ( Kept == NoSolutionExists && max_positions != -1 )
+            mm = new MemoryManager();
+        m_searching = true;
+    }
 
     /* Initialize the suitable() macro variables. */
-    init();
+    Mem_used = 0;
+    init( kept );
+    mm->reset_peak();
+
+    /* Go to it.  A game that can number its positions goes through them
+       itself.  Otherwise, where the best-first search gives up, the
+       depth-first one starts over with what the best-first one had
+       taken. */
+    bool printed = false;
+    if ( solve_exactly() )
+    {
+    }
+    else if ( m_engine == DepthFirstEngine )
+    {
+        bool verify = max_positions == -1 && save_start();
+        depth_first( kept );
+        printed = true;
+
+        /* The table told the positions apart by their prints.  If it
+           says the deal is lost, the bound never cut the search short,
+           and the best-first search goes through the same positions once
+           more with their keys, to say so for sure if it has the memory. */
+        if ( verify && Status == NoSolutionExists )
+        {
+            restart( kept );
+            {
+                QMutexLocker lock( &statsMutex );
+                Table.clear();
+            }
+            firstMoves.clear();
+            doit( kept );
+            printed = mm->Storemode == MemoryManager::HASH_STORE && m_checkpoint > 1;
+        }
+    }
+    else
+    {
+        bool fallback = m_engine == AutomaticEngine && save_start();
+        printed = mm->Storemode == MemoryManager::HASH_STORE && m_checkpoint > 1;
+        doit( kept );
+        if ( fallback && ( Status == MemoryLimitReached || Status == UnableToDetermineSolvability ) )
+        {
+            restart( kept );
+            depth_first( kept );
+            printed = true;
+        }
+    }
 
-    /* Go to it. */
-    doit();
+    /* A search that told the positions apart by their prints only (the
+       transposition table, or the store with checkpoints) may have taken
+       a new position for one it had seen, and never looked at what comes
+       of it.  What it wins is won, but it can't be sure there is no
+       solution. */
+    if ( Status == NoSolutionExists && printed )
+        Status = UnableToDetermineSolvability;
+    all_moves.fetchAndAddRelaxed( Stats.expanded );
+    Pilestats.piles = Piles->count();
+    Pilestats.size = Piles->size();
 
     if ( Status == SearchAborted ) // thread quit
     {
         firstMoves.clear();
         winMoves.clear();
     }
-#if 0
-    printf("%ld positions generated (%f).\n", Total_generated, depth_sum / Total_positions);
-    printf("%ld unique positions.\n", Total_positions);
-    printf("Mem_remain = %ld\n", ( long int )mm->Mem_remain);
-#endif
+
+    /* What the search took stays in the statistics. */
+    {
+        QMutexLocker lock( &statsMutex );
+        Mem_used = qMax<size_t>( Mem_used, peak_memory() );
+        count_memory( &Stats );
+        Table.clear();
+        m_searching = false;
+    }
+    if ( debug )
+        printStatistics( stderr );
+
+    if ( mm != kept )
+    {
+        QMutexLocker lock( &statsMutex );
+        mm->free_clusters();
+        mm->free_blocks();
+        delete mm;
+        mm = kept;
+    }
+    else if ( max_positions == -1 )
+    {
+        keep_positions();
+    }
     free();
     return Status;
 }
@@ -994,6 +1746,172 @@ void Solver::setNumberPiles( int p )
     Whash = new quint32[m_number_piles];
     Wpilenum = new int[m_number_piles];
     memset( Wpilenum, 0, sizeof( int ) * m_number_piles );
+
+    Wseen = new card_t*[m_number_piles];
+    Wprefix = new quint32*[m_number_piles];
+    Wprefixset = new cardset_t*[m_number_piles];
+    for ( int i = 0; i < m_number_piles; ++i )
+    {
+        Wseen[i] = new card_t[84];
+        Wprefix[i] = new quint32[85];
+        Wprefix[i][0] = FNV1_32_INIT;
+        Wprefixset[i] = new cardset_t[85];
+        Wprefixset[i][0] = 0;
+    }
+    Wseenlen = new int[m_number_piles];
+    memset( Wseenlen, 0, sizeof( int ) * m_number_piles );
+    Wset = new cardset_t[m_number_piles];
+    memset( Wset, 0, sizeof( cardset_t ) * m_number_piles );
+
+    /* A pile number takes up to 5 bytes in a key. */
+    Wcanonpile = new int[m_number_piles];
+    Wcanon = new quint8[1 + 5 * m_number_piles];
+}
+
+void Solver::setStoreMode( MemoryManager::storemode mode )
+{
+    mm->Storemode = mode;
+}
+
+SOLVERSTATS Solver::statistics() const
+{
+    QMutexLocker lock( &statsMutex );
+    SOLVERSTATS stats = Stats;
+    foreach ( const Solver *w, m_workers )
+        add_stats( &stats, w->Stats );
+    if ( m_searching )
+        count_memory( &stats );
+    return stats;
+}
+
+/* What the store and the piles take now.  The workers store their
+positions in our table, but in blocks of their own. */
+
+void Solver::count_memory( SOLVERSTATS *stats ) const
+{
+    stats->nodemem = mm->Nodemem.load();
+    stats->keymem = mm->Keymem.load();
+    foreach ( const Solver *w, m_workers )
+    {
+        stats->nodemem += w->mm->Nodemem.load();
+        stats->keymem += w->mm->Keymem.load();
+    }
+    stats->tablemem = mm->Tablemem.load() + Table.memory();
+    stats->pilemem = Piles->memory();
+}
+
+/* The same, all together.  Unlike the budget of the memory manager, it
+doesn't count what other solvers take at the same time. */
+
+quint64 Solver::memory_in_use() const
+{
+    quint64 bytes = mm->Nodemem.load() + mm->Keymem.load() + mm->Tablemem.load();
+    foreach ( const Solver *w, m_workers )
+        bytes += w->mm->Nodemem.load() + w->mm->Keymem.load();
+    return bytes + Table.memory() + Piles->memory();
+}
+
+/* The most it took since the search started, or started over.  The
+tables and the piles don't give memory back before then, and the store
+hardly ever does, so every part at its most is what they held at once. */
+
+quint64 Solver::peak_memory() const
+{
+    quint64 bytes = mm->Peak.load();
+    foreach ( const Solver *w, m_workers )
+        bytes += w->mm->Peak.load();
+    return bytes + Table.memory() + Piles->memory();
+}
+
+void Solver::printStatistics( FILE *out ) const
+{
+    const SOLVERSTATS s = statistics();
+    const quint64 generated = s.generated;
+    const quint64 positions = s.positions;
+
+    fprintf( out, "%llu positions generated, %llu new, %llu seen before (%.1f%%), %llu expanded, average depth %.1f\n",
+             ( unsigned long long )generated, ( unsigned long long )positions,
+             ( unsigned long long )s.duplicates, generated ? 100.0 * s.duplicates / generated : 0.0,
+             ( unsigned long long )s.expanded, positions ? double( s.depthsum ) / positions : 0.0 );
+    if ( m_timing )
+        fprintf( out, "ms: moves %.1f, make/undo %.1f, pack/insert %.1f, queues %.1f\n",
+                 s.movegen_ns / 1e6, s.makemove_ns / 1e6, s.insert_ns / 1e6, s.queue_ns / 1e6 );
+    fprintf( out, "queues: %llu in, %llu out, %.1f looked at per position\n",
+             ( unsigned long long )s.enqueued, ( unsigned long long )s.dequeued,
+             s.dequeued ? double( s.qscans ) / s.dequeued : 0.0 );
+    fprintf( out, "queued:" );
+    for ( int i = 0; i < NQUEUES; ++i )
+        if ( s.queued[i] )
+            fprintf( out, " %d:%llu", i, ( unsigned long long )s.queued[i] );
+    fprintf( out, "\nbytes: nodes %llu, keys %llu, table %llu, piles %llu\n",
+             ( unsigned long long )s.nodemem, ( unsigned long long )s.keymem,
+             ( unsigned long long )s.tablemem, ( unsigned long long )s.pilemem );
+}
+
+void Solver::setEngine( SearchEngine engine )
+{
+    m_engine = engine;
+}
+
+void Solver::setQueuePolicy( QueuePolicy policy )
+{
+    delete Queue;
+    if ( policy == BestFirstQueues )
+        Queue = new BucketFrontier();
+    else
+        Queue = new RoundRobinFrontier();
+    m_queue_policy = policy;
+}
+
+void Solver::stop()
+{
+    m_shouldEnd.store( 1 );
+}
+
+void Solver::setTimeLimit( int msecs )
+{
+    m_time_limit = msecs < 0 ? -1 : msecs;
+}
+
+void Solver::setMemoryLimit( size_t bytes )
+{
+    m_memory_limit = bytes;
+}
+
+void Solver::setTiming( bool timing )
+{
+    m_timing = timing;
+}
+
+void Solver::setThreadCount( int threads )
+{
+    m_threads = qMax( 1, threads );
+}
+
+void Solver::setIncremental( bool incremental )
+{
+    m_incremental = incremental;
+    if ( !incremental )
+        forgetPositions();
+}
+
+void Solver::forgetPositions()
+{
+    Kept = UnableToDetermineSolvability;
+    Winkeys.clear();
+    Winline.clear();
+    free();
+}
+
+void Solver::setListener( SolverListener *listener )
+{
+    m_listener = listener;
+}
+
+void Solver::setCheckpointInterval( int depth )
+{
+    /* unpack_position() recurses once per move it replays */
+    m_checkpoint = qBound( 1, depth, 64 );
 }
 
 int Solver::translateSuit( int s )
@@ -1023,46 +1941,82 @@ int Solver::translate_pile(const KCardPile *pile, card_t *w, int size)
 }
 
 /* Insert key into the tree unless it's already there.  Return true if
-it was new. */
+it was new.  k is the cluster number of the position. */
 
-MemoryManager::inscode Solver::insert(unsigned int *cluster, int d, TREE **node)
+MemoryManager::inscode Solver::insert(unsigned int k, int d, quint8 **node)
 {
-	/* Get the cluster number from the Out cell contents. */
-
-        unsigned int k = getClusterNumber();
-        *cluster = k;
-
         /* Get the tree for this cluster. */
 
-	TREELIST *tl = mm->cluster_tree(k);
-	if (tl == NULL) {
-		return MemoryManager::ERR;
+	TREELIST *tl = NULL;
+	if (mm->Storemode == MemoryManager::TREE_STORE) {
+		tl = mm->cluster_tree(k);
+		if (tl == NULL) {
+			return MemoryManager::ERR;
+		}
 	}
 
 	/* Create a compact position representation. */
 
-	TREE *newtree = pack_position();
-	if (newtree == NULL) {
+	quint8 *key = pack_position();
+	if (key == NULL) {
 		return MemoryManager::ERR;
 	}
-        Total_generated++;
+        ++Stats.generated;
+
+        MemoryManager::inscode i2;
+	if (tl) {
+		TREE *newtree = (TREE *)(key - sizeof(TREE));
+		TREE *tree;
+		i2 = mm->insert_node(newtree, d, &tl->tree, &tree);
+		*node = (quint8 *)tree + sizeof(TREE);
+	} else {
+		unsigned int ck = k;
+		quint8 *ckey = Nsymmetric ? canonical_key(key, &ck) : key;
+		quint8 *copy = NULL;
+		if (ckey == NULL) {
+			i2 = MemoryManager::ERR;
+		} else if (m_checkpoint > 1) {
+			i2 = store()->insert_print(ckey, ck);
+			*node = d % m_checkpoint == 0 ? key : NULL;
+		} else if (ckey == key) {
+			i2 = store()->insert_key(key, ck, node);
+		} else {
 
-        MemoryManager::inscode i2 = mm->insert_node(newtree, d, &tl->tree, node);
+			/* The store gets a key of its own with the suits
+			renamed, the position keeps its real layout. */
+
+			copy = mm->new_key();
+			if (copy == NULL) {
+				i2 = MemoryManager::ERR;
+			} else {
+				memcpy(copy, ckey, key_length(ckey));
+				mm->trim_key(copy);
+				i2 = store()->insert_key(copy, ck, node);
+				*node = key;
+			}
+		}
+		if (i2 == MemoryManager::ERR) {
+			Status = UnableToDetermineSolvability;
+		}
+		if (copy && i2 != MemoryManager::NEW) {
+			mm->give_back_key(copy);
+		}
+	}
 
-	if (i2 != MemoryManager::NEW) {
-		mm->give_back_block((quint8 *)newtree);
+	if (i2 != MemoryManager::NEW || *node == NULL) {
+		mm->give_back_key(key);
 	}
 
 	return i2;
 }
 
 
-POSITION *Solver::new_position(POSITION *parent, MOVE *m)
+POSITION *Solver::new_position(POSITION *parent, MOVE *m, unsigned int cluster)
 {
-	unsigned int depth, cluster;
+	unsigned int depth;
 	quint8 *p;
 	POSITION *pos;
-	TREE *node;
+	quint8 *node;
 
 	/* Search the list of stored positions.  If this position is found,
 	then ignore it and return (unless this position is better). */
@@ -1072,27 +2026,29 @@ POSITION *Solver::new_position(POSITION *parent, MOVE *m)
 	} else {
 		depth = parent->depth + 1;
 	}
-        MemoryManager::inscode i = insert(&cluster, depth, &node);
+        MemoryManager::inscode i = insert(cluster, depth, &node);
         if (i == MemoryManager::NEW) {
-                Total_positions++;
-                depth_sum += depth;
-        } else
-            return NULL;
+                ++Stats.positions;
+                if (m_pool) {
+                        m_pool->positions.ref();
+                }
+                Stats.depthsum += depth;
+        } else {
+                if (i == MemoryManager::FOUND) {
+                        ++Stats.duplicates;
+                }
+                return NULL;
+        }
 
 
 	/* A new or better position.  insert() already stashed it in the
 	tree, we just have to wrap a POSITION struct around it, and link it
 	into the move stack.  Store the temp cells after the POSITION. */
 
-	if (Freepos) {
-		p = (quint8 *)Freepos;
-		Freepos = Freepos->queue;
-	} else {
-		p = mm->new_from_block(Posbytes);
-		if (p == NULL) {
-                        Status = UnableToDetermineSolvability;
-			return NULL;
-		}
+	p = (quint8 *)mm->new_from_slab(Posbytes);
+	if (p == NULL) {
+                Status = UnableToDetermineSolvability;
+		return NULL;
 	}
 
 	pos = (POSITION *)p;
@@ -1105,13 +2061,12 @@ POSITION *Solver::new_position(POSITION *parent, MOVE *m)
 	pos->nchild = 0;
 #if 0
         QString dummy;
-        quint16 *t = ( quint16* )( ( char* )node + sizeof( TREE ) );
         for ( int i = 0; i < m_number_piles; ++i )
         {
-            QString s = "      " + QString( "%1" ).arg( ( int )t[i] );
+            QString s = "      " + QString( "%1" ).arg( Wpilenum[i] );
             dummy += s.right( 5 );
         }
-        if ( Total_positions % 1000 == 1000 )
+        if ( Stats.positions % 1000 == 1000 )
             print_layout();
         //qDebug() << "new" << dummy;
 #endif
@@ -20,10 +20,17 @@
 #define PATSOLVE_H
 
 #include "../hint.h"
+#include "cardset.h"
+#include "frontier.h"
 #include "memory.h"
+#include "piletable.h"
+#include "transtable.h"
 
 #include "KCardPile"
 
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMap>
 #include <QtCore/QMutex>
 
@@ -53,12 +60,58 @@ public:
     }
 };
 
+/* A count that the thread of a search keeps and other threads may read
+while it runs.  Its relaxed loads and stores cost no more than those of a
+plain integer on common hardware, so only one thread may change it at a
+time. */
+class Tally
+{
+public:
+    Tally() : v( 0 ) {}
+    Tally &operator++() { v.store( v.load() + 1 ); return *this; }
+    Tally &operator--() { v.store( v.load() - 1 ); return *this; }
+    Tally &operator+=( quint64 n ) { v.store( v.load() + n ); return *this; }
+    Tally &operator=( quint64 n ) { v.store( n ); return *this; }
+    operator quint64() const { return v.load(); }
+
+private:
+    QAtomicInteger<quint64> v;
+};
+
+/* What a search has been doing, see Solver::statistics(). */
+struct SOLVERSTATS {
+	Tally generated;        /* positions reached by a move */
+	Tally duplicates;       /* of them, the ones seen before */
+	Tally positions;        /* of them, the new ones */
+	Tally expanded;         /* positions whose moves were generated */
+	Tally depthsum;         /* the depths of the new positions */
+	Tally bestouts;         /* the most cards out in a position expanded */
+
+	/* Nanoseconds spent, only counted with Solver::setTiming(). */
+	Tally movegen_ns;       /* generating the moves */
+	Tally makemove_ns;      /* making and taking back moves */
+	Tally insert_ns;        /* packing positions and looking them up */
+	Tally queue_ns;         /* queueing and unpacking positions */
+
+	Tally queued[NQUEUES];  /* positions waiting, by priority */
+	Tally enqueued;         /* positions put in the queues */
+	Tally dequeued;         /* positions taken out of them */
+	Tally qscans;           /* queues looked at to find those */
+
+	/* Bytes in use, only filled in by Solver::statistics(). */
+	Tally nodemem;          /* positions, tree nodes and move arrays */
+	Tally keymem;           /* packed positions */
+	Tally tablemem;         /* the hash table of the positions, or the
+	                           transposition table */
+	Tally pilemem;          /* the interned piles */
+};
+
 struct POSITION;
 
 struct POSITION {
         POSITION *queue;      /* next position in the queue */
 	POSITION *parent;     /* point back up the move stack */
-	TREE *node;             /* compact position rep.'s tree node */
+	quint8 *node;           /* compact position rep. (the store's key) */
 	MOVE move;              /* move that got us here from the parent */
 	quint32 cluster; /* the cluster this node is in */
 	short depth;            /* number of moves so far */
@@ -67,12 +120,27 @@ struct POSITION {
 };
 
 class MemoryManager;
+class SolverPool;
+
+/* Is told how a search is getting on, from the thread it runs in. */
+class SolverListener
+{
+public:
+    virtual ~SolverListener() {}
+
+    /* The moves from the start position are known, long before the
+       search is over. */
+    virtual void firstMovesFound( const QList<MOVE> &moves ) = 0;
+};
 
 class Solver
 {
+    friend class SolverWorker;
+
 public:
     enum ExitStatus
     {
+        TimeLimitReached = -4,
         MemoryLimitReached = -3,
         SearchAborted = -2,
         UnableToDetermineSolvability = -1,
@@ -80,36 +148,156 @@ public:
         SolutionExists = 1
     };
 
+    /* How to search.  The best-first search remembers every position it
+       has seen, which finds good solutions fast, but takes a lot of
+       memory.  The depth-first search makes do with a table of fixed
+       size (see depth_first()), but may look at the same positions many
+       times, and as it only keeps their prints, a deal it finds lost is
+       searched best-first once more, which proves it lost if it fits
+       into memory.  The automatic choice searches best-first and goes on
+       depth-first if that runs out of memory or positions, so it can't
+       prove a deal lost after that.  A position limit holds for either
+       engine on its own. */
+    enum SearchEngine
+    {
+        BestFirstEngine,
+        DepthFirstEngine,
+        AutomaticEngine
+    };
+
+    /* Which position the best-first search expands next, see
+       frontier.h.  The round robin looks at low priorities now and
+       then, best-first always takes the highest priority. */
+    enum QueuePolicy
+    {
+        RoundRobinQueues,
+        BestFirstQueues
+    };
+
     Solver();
+    Solver( const Solver &other );
     virtual ~Solver();
     ExitStatus patsolve( int max_positions = -1, bool debug = false);
     bool recursive(POSITION *pos = 0);
     virtual void translate_layout() = 0;
-    bool m_shouldEnd;
-    QMutex endMutex;
     virtual MoveHint translateMove(const MOVE &m ) = 0;
     QList<MOVE> firstMoves;
     QList<MOVE> winMoves;
 
+    /* The moves to the position with the most cards out the search got
+       to (see SOLVERSTATS::bestouts), the best it has to offer when it
+       ends without an answer, even if it was stopped. */
+    QList<MOVE> bestMoves;
+
+    /* Stop the running search from another thread.  It returns
+       SearchAborted as soon as it notices, which it does before it
+       expands another position. */
+    void stop();
+
+    void setStoreMode( MemoryManager::storemode mode );
+    void setEngine( SearchEngine engine );
+    void setQueuePolicy( QueuePolicy policy );
+
+    /* Search with this many threads.  Every thread runs its own copy of
+       the solver (see clone()) and they share one position store.  A
+       search limited to a few positions, like a look for the moves from
+       a position, goes without them. */
+    void setThreadCount( int threads );
+
+    /* Keep the packed layout only for positions at every depth-th move
+       and replay the moves from there to unpack the others.  The store
+       then only remembers a print of the positions it has seen, so the
+       search can find a win but not prove there is none.  This saves
+       memory at the cost of time; 1 keeps every layout.  Only the hash
+       store can do it. */
+    void setCheckpointInterval( int depth );
+
+    /* Let every search start from what the one before found out, for
+       following a game as it is played.  If a search proves its
+       position lost, so is every position it has seen: the store is
+       kept, and the next search is over at once if it starts from one
+       of them, and doesn't look at them again otherwise.  If it finds
+       a win, the positions along the winning line are kept, and a
+       search from one of them just takes the rest of the line.  A
+       search with a position limit only looks at what was kept.  Only
+       the hash store can keep positions. */
+    void setIncremental( bool incremental );
+
+    /* Drop the kept positions, e.g. when a new deal starts. */
+    void forgetPositions();
+
+    /* Tell listener about the searches from now on, 0 for nobody. */
+    void setListener( SolverListener *listener );
+
+    /* Give up after msecs milliseconds with TimeLimitReached, -1 for
+       no limit.  Like the position limit of patsolve(), it holds for
+       every search from now on. */
+    void setTimeLimit( int msecs );
+
+    /* Give up with UnableToDetermineSolvability, as if malloc() had
+       failed, once the store, the piles and the tables of this solver
+       and its workers take more than bytes, 0 for no limit.  For solvers
+       that search at the same time and share the limit of the memory
+       manager. */
+    void setMemoryLimit( size_t bytes );
+
+    /* Numbers of the last search, for benchmarking.  The memory is the
+       most this solver and its workers held at once. */
+    unsigned long generatedPositions() const { return Stats.generated; }
+    unsigned long storedPositions() const { return Stats.positions; }
+    size_t usedMemory() const { return Mem_used; }
+
+    /* All the numbers of the running or the last search, with those of
+       its workers.  Another thread may ask for them at any time. */
+    SOLVERSTATS statistics() const;
+    void printStatistics( FILE *out ) const;
+
+    /* Take the time every phase of the search takes.  This slows it
+       down noticeably. */
+    void setTiming( bool timing );
+
+    /* How often the pile table was probed and how full it got. */
+    const PILESTATS &pileStats() const { return Pilestats; }
+
 protected:
-    MOVE *get_moves(int *nmoves);
-    bool solve(POSITION *parent);
-    void doit();
+    /* The search loops, which call the rules below for every move.  They
+       are compiled for each game, see solvercore.h. */
+    virtual MOVE *get_moves(int *nmoves) = 0;
+    virtual bool solve(POSITION *parent) = 0;
+    virtual bool dfs(int depth, int budget, bool *lost) = 0;
+
+    void print_moves(int n);
+    MOVE *save_moves(int n, int numout, int *nmoves);
+    bool may_expand(void);
+    void drop_child(POSITION *parent);
+    bool let_go(POSITION *parent, bool keep);
+    void doit(MemoryManager *kept);
+    void depth_first(MemoryManager *kept);
+    quint64 position_print(unsigned int k);
+    bool save_start(void);
+    void restart(MemoryManager *kept);
+    bool known_position(MemoryManager *kept);
+    void keep_positions(void);
+    void count_memory(SOLVERSTATS *stats) const;
+    quint64 memory_in_use(void) const;
+    quint64 peak_memory(void) const;
     void win(POSITION *pos);
+    void best(POSITION *pos);
+    bool interrupted(bool clock);
     virtual int get_possible_moves(int *a, int *numout) = 0;
     int translateSuit( int s );
 
     int wcmp(int a, int b);
-    void queue_position(POSITION *pos, int pri);
+    void queue_position(POSITION *pos, int pri, int nout);
     void free_position(POSITION *pos, int);
     POSITION *dequeue_position();
     void hashpile(int w);
-    POSITION *new_position(POSITION *parent, MOVE *m);
-    TREE *pack_position(void);
+    POSITION *new_position(POSITION *parent, MOVE *m, unsigned int cluster);
+    quint8 *pack_position(void);
     void unpack_position(POSITION *pos);
     void init_buckets(void);
     int get_pilenum(int w);
-    MemoryManager::inscode insert(unsigned int *cluster, int d, TREE **node);
+    MemoryManager::inscode insert(unsigned int k, int d, quint8 **node);
     void free_buckets(void);
     void printcard(card_t card, FILE *outfile);
     int translate_pile(const KCardPile *pile, card_t *w, int size);
@@ -125,10 +313,54 @@ protected:
     virtual unsigned int getClusterNumber() { return 0; }
     virtual void unpack_cluster( unsigned int  ) {}
 
+    /* Suit symmetry.  If the rules don't tell some suits apart, the suits
+       of a class can be swapped in a position without changing what can
+       be done with it.  classes[s] is the class of suit s, -1 for a suit
+       of its own.  The store then keeps the key of one position of each
+       set of swapped ones, see canonical_key(), next to the layouts of
+       the positions themselves.  Only the hash store can do it.  No game
+       turns it on: within one deal, the cards that are buried or face
+       down tell the suits apart, and in FreeCell, Gypsy and Spider hardly
+       any position ever met its twin with swapped suits, while renaming
+       the suits slowed the search down by a fifth.  FreeCell, Gypsy and
+       Spider still tell how their piles and clusters are renamed. */
+    void setSuitSymmetry( const int *classes );
+    void suit_perm(int *perm);
+    quint8 *canonical_key(quint8 *key, unsigned int *cluster);
+
+    /* The runs the piles build down in, which the pile table then keeps
+       packed.  Set it before the search. */
+    void setPileRuns( PileRuns runs ) { Piles->setRuns( runs ); }
+
+    /* Where pile w goes and what becomes of cluster k when suit s is
+       renamed to perm[s], for the games that have piles or out cells
+       that belong to a suit. */
+    virtual int suit_pile( int w, const int * ) { return w; }
+    virtual unsigned int suit_cluster( unsigned int k, const int * ) { return k; }
+
+    /* A copy of this solver for a worker thread, or 0 if the game
+       can't be searched in parallel. */
+    virtual Solver *clone() const { return 0; }
+
+    /* A game with so few positions that it can number them all may
+       search them itself, in the layout of translate_layout(), instead
+       of the engines.  It sets Status, the moves and the statistics,
+       and returns true; or false to leave it to the engines. */
+    virtual bool solve_exactly() { return false; }
+
+    /* Parallel search. */
+    bool start_workers(void);
+    void work(void);
+    void stop_workers(void);
+    POSITION *take_position(void);
+    POSITION *steal_position(void);
+    MemoryManager *store(void) const;
+    PileTable *piles(void) const;
+
     void setNumberPiles( int i );
     int m_number_piles;
 
-    void init();
+    void init(MemoryManager *kept);
     void free();
 
     /* Work arrays. */
@@ -140,30 +372,74 @@ protected:
     /* Every different pile has a hash and a unique id. */
     quint32 *Whash;
     int *Wpilenum;
-
-    /* Position freelist. */
-
-    POSITION *Freepos;
-
-#define MAXMOVES 64             /* > max # moves from any position */
+    PileTable *Piles;
+    PILESTATS Pilestats;
+
+    /* The hashes and card sets of the bottom parts of each pile and
+       the cards they were computed from, for hashpile(). */
+    quint32 **Wprefix;
+    cardset_t **Wprefixset;
+    card_t **Wseen;
+    int *Wseenlen;
+
+    /* The cards in each pile, see cardset.h. */
+    cardset_t *Wset;
+
+    /* The suit classes, and the key of the position with the suits
+       swapped, see canonical_key(). */
+    int Suitclass[4];
+    int Suitbase[4];          /* undoes suit_perm() of the first position */
+    int Nsymmetric;           /* suits that can be swapped with others */
+    int *Wcanonpile;
+    quint8 *Wcanon;
+
+#define MAXMOVES 128            /* > max # moves from any position */
     MOVE Possible[MAXMOVES];
 
     MemoryManager *mm;
     ExitStatus Status;             /* win, lose, or fail */
 
-#define NQUEUES 127
-
-    POSITION *Qhead[NQUEUES]; /* separate queue for each priority */
-    int Maxq;
+    Frontier *Queue;          /* the positions waiting, by priority */
+    QueuePolicy m_queue_policy;
+    QMutex queueMutex;        /* guards the queues from thieves */
+
+    int m_threads;
+    SearchEngine m_engine;
+    int m_checkpoint;
+    bool m_incremental;
+    ExitStatus Kept;          /* what the kept positions are known to be,
+                                 UnableToDetermineSolvability if none */
+    QList<QByteArray> Winkeys; /* the positions along the winning line */
+    QList<MOVE> Winline;
+    SolverListener *m_listener;
+    SolverPool *m_pool;       /* the running parallel search, if any */
+    QList<Solver *> m_workers;
 
     bool m_newer_piles_first;
-    unsigned long Total_generated, Total_positions;
-    qreal depth_sum;
+    bool m_timing;
+    bool m_searching;
+    SOLVERSTATS Stats;
+    mutable QMutex statsMutex; /* guards the workers, the store and
+                                  m_searching for statistics() */
+    size_t Mem_used;
+
+    /* Depth-first search. */
+    TranspositionTable Table;
+    int Iteration;            /* the current bound is Iteration - 1 */
+    bool Cut;                 /* the bound cut off some moves */
+    QList<MOVE> Line;         /* the moves to the current position */
+    QByteArray Startkey;      /* see save_start() */
+    unsigned int Startcluster;
+    quint64 Startpositions;   /* what the best-first search looked at */
 
     POSITION *Stack;
     QMap<qint32,bool> recu_pos;
     int max_positions;
     bool debug;
+    int m_time_limit;
+    size_t m_memory_limit;
+    QElapsedTimer m_clock;      /* started with the search */
+    QAtomicInt m_shouldEnd;     /* see stop() */
 };
 
 /* Misc. */
@@ -185,6 +461,7 @@ protected:
 #define COLOR(card) ((card) & PS_COLOR)
 #define DOWN(card) ((card) & ( 1 << 7 ) )
 
-extern long all_moves;
+/* Positions expanded by all searches, which may run at the same time. */
+extern QAtomicInteger<long> all_moves;
 
 #endif // PATSOLVE_H
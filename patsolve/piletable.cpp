@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) 1998-2002 Tom Holroyd <tomh@kurage.nimh.nih.gov>
+ * Copyright (C) 2006-2009 Stephan Kulow <coolo@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "piletable.h"
+
+#include "memory.h"
+
+#include <climits>
+#include <cstring>
+
+
+#define PILE_INITIAL_BITS 10
+#define PILE_INITIAL_INDEX 1024
+#define PILE_CHUNK (16 * 4096)
+#define PILE_ALIGN 8
+#define PILE_MULTIPLIER 0x9E3779B9U     /* 2^32 / golden ratio */
+#define PILE_MAXCARDS 84                /* the size of the work piles */
+
+/* The bits of a card, as in patsolve.h.  The one a card doesn't use marks
+the first card of a packed run. */
+
+#define PILE_RANK 0x0F
+#define PILE_COLOR 0x10
+#define PILE_SUIT 0x30
+#define PILE_RUN 0x40
+#define PILE_DOWN 0x80
+
+PileTable::PileTable()
+    : Count(0),
+      Runs(NoRuns),
+      Chunks(NULL),
+      Chunk(NULL),
+      Chunkleft(0)
+{
+}
+
+PileTable::~PileTable()
+{
+	clear();
+}
+
+size_t PileTable::size() const
+{
+	PILESLOTS *t = Slots.loadAcquire();
+
+	return t ? t->size : 0;
+}
+
+/* The number of cards at the start of cards[] that make a run, at least
+one. */
+
+int PileTable::run_length(const quint8 *cards, int len) const
+{
+	int n;
+	quint8 a, b;
+
+	for (n = 1; n < len; n++) {
+		a = cards[n - 1];
+		b = cards[n];
+		if ((a | b) & PILE_DOWN || (b & PILE_RANK) + 1 != (a & PILE_RANK)) {
+			break;
+		}
+		if (Runs == SameSuitRuns ? (a ^ b) & PILE_SUIT : !((a ^ b) & PILE_COLOR)) {
+			break;
+		}
+	}
+
+	return n;
+}
+
+/* Pack the runs of a pile into data, and return its size.  A run becomes
+its first card, marked, and its length; and if it alternates colors, the
+bits of the suits of the other cards, eight to a byte.  Runs too short to
+gain anything are kept as they are, so data never needs more than len
+bytes. */
+
+int PileTable::pack(const quint8 *cards, int len, quint8 *data) const
+{
+	int i, k, n, bits;
+	quint8 *q, b;
+
+	q = data;
+	for (i = 0; i < len; i += n) {
+		n = run_length(cards + i, len - i);
+		bits = Runs == AlternateColorRuns ? (n + 6) / 8 : 0;
+		if (n < 3 + bits) {
+			memcpy(q, cards + i, n);
+			q += n;
+			continue;
+		}
+		*q++ = cards[i] | PILE_RUN;
+		*q++ = n;
+		for (k = 1; k < n && bits; q++) {
+			*q = 0;
+			for (b = 0; k < n && b < 8; k++, b++) {
+				if (cards[i + k] & (PILE_SUIT & ~PILE_COLOR)) {
+					*q |= 1 << b;
+				}
+			}
+		}
+	}
+
+	return q - data;
+}
+
+/* The card after c in a run that alternates colors.  k counts the cards
+of the run after the first, the bits of their suits are taken from *d. */
+
+static inline quint8 run_next(quint8 c, int k, const quint8 **d, quint8 *bits)
+{
+	if (k % 8 == 1) {
+		*bits = *(*d)++;
+	}
+	c = ((c - 1) & PILE_RANK) | ((c & PILE_COLOR) ^ PILE_COLOR) |
+	    (*bits & 1 ? PILE_SUIT & ~PILE_COLOR : 0);
+	*bits >>= 1;
+
+	return c;
+}
+
+/* Copy the cards of a pile, unpacking its runs.  Every card of a run is
+one rank below the one before it, of the same suit or the other color. */
+
+void PileTable::unpack(const PILE *p, quint8 *cards) const
+{
+	const quint8 *d, *end;
+	quint8 c, bits;
+	int k, n;
+
+	if (Runs == NoRuns) {
+		memcpy(cards, p->data(), p->len);
+		return;
+	}
+
+	bits = 0;
+	d = p->data();
+	end = d + p->size;
+	while (d < end) {
+		c = *d++;
+		if (!(c & PILE_RUN)) {
+			*cards++ = c;
+			continue;
+		}
+		c &= ~PILE_RUN;
+		n = *d++;
+		if (Runs == SameSuitRuns) {
+			for (k = 0; k < n; k++) {
+				*cards++ = c - k;
+			}
+			continue;
+		}
+		*cards++ = c;
+		for (k = 1; k < n; k++) {
+			c = run_next(c, k, &d, &bits);
+			*cards++ = c;
+		}
+	}
+}
+
+/* Whether a pile has these cards.  They are compared with the runs as
+they are unpacked, so a lookup needn't pack them first. */
+
+bool PileTable::same(const PILE *p, const quint8 *cards) const
+{
+	const quint8 *d, *end;
+	quint8 c, bits;
+	int k, n;
+
+	if (Runs == NoRuns) {
+		return memcmp(p->data(), cards, p->len) == 0;
+	}
+
+	bits = 0;
+	d = p->data();
+	end = d + p->size;
+	while (d < end) {
+		c = *d++;
+		if (!(c & PILE_RUN)) {
+			if (*cards++ != c) {
+				return false;
+			}
+			continue;
+		}
+		c &= ~PILE_RUN;
+		n = *d++;
+		if (Runs == SameSuitRuns) {
+			for (k = 0; k < n; k++) {
+				if (*cards++ != c - k) {
+					return false;
+				}
+			}
+			continue;
+		}
+		if (*cards++ != c) {
+			return false;
+		}
+		for (k = 1; k < n; k++) {
+			c = run_next(c, k, &d, &bits);
+			if (*cards++ != c) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Look for a pile in one generation of the slots, with linear probing from
+the high bits of a multiplicative hash.  If it isn't there, return NULL and
+the empty slot that ends the probe sequence. */
+
+const PILE *PileTable::lookup(PILESLOTS *t, const quint8 *cards, int len,
+                              quint32 hash, size_t *slot, int *probes) const
+{
+	size_t i, mask;
+	const PILE *p;
+
+	mask = t->size - 1;
+	i = (quint32)(hash * PILE_MULTIPLIER) >> t->shift;
+	for (;;) {
+		++*probes;
+		p = t->entries[i].loadAcquire();
+		if (p == NULL) {
+			*slot = i;
+			return NULL;
+		}
+		if (p->hash == hash && p->len == len && same(p, cards)) {
+			return p;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+int PileTable::find(const quint8 *cards, int len, quint32 hash, PILESTATS *stats)
+{
+	PILESLOTS *t;
+	PILEINDEX *x;
+	const PILE *p;
+	PILE *n;
+	size_t slot;
+	int i, size, probes = 0;
+	quint8 packed[PILE_MAXCARDS];
+
+	/* Nearly every pile is known already.  A slot only ever goes from
+	empty to a complete pile, so finding it needs no lock. */
+
+	t = Slots.loadAcquire();
+	p = t ? lookup(t, cards, len, hash, &slot, &probes) : NULL;
+
+	/* Otherwise look again under the lock, another thread may have
+	added it in the meantime (maybe to a bigger table). */
+
+	if (p == NULL) {
+		QMutexLocker lock(&Insertmutex);
+
+		t = Slots.load();
+		p = t ? lookup(t, cards, len, hash, &slot, &probes) : NULL;
+		if (p == NULL && Count < INT_MAX) {
+
+			/* Keep the load factor below 1/2, and make room
+			for the new id. */
+
+			if (t == NULL || (size_t)(Count + 1) * 2 > t->size) {
+				if (!grow_slots()) {
+					goto out;
+				}
+				t = Slots.load();
+				lookup(t, cards, len, hash, &slot, &probes);
+			}
+			x = Index.load();
+			if (x == NULL || Count == x->size) {
+				if (!grow_index()) {
+					goto out;
+				}
+				x = Index.load();
+			}
+			Q_ASSERT(len <= PILE_MAXCARDS);
+			if (Runs == NoRuns) {
+				size = len;
+				memcpy(packed, cards, len);
+			} else {
+				size = pack(cards, len, packed);
+			}
+			if ((n = new_pile(size)) == NULL) {
+				goto out;
+			}
+			n->hash = hash;
+			n->len = len;
+			n->size = size;
+			n->id = Count;
+			n->set = 0;
+			for (i = 0; i < len; i++) {
+				n->set |= card_bit(cards[i]);
+			}
+			memcpy(n + 1, packed, size);
+
+			/* The index entry must be there before anybody
+			can see the id. */
+
+			x->piles[Count++] = n;
+			t->entries[slot].storeRelease(n);
+			p = n;
+		}
+	}
+
+out:
+	stats->lookups++;
+	stats->probes += probes;
+	if (probes > stats->maxprobe) {
+		stats->maxprobe = probes;
+	}
+
+	return p ? p->id : -1;
+}
+
+/* Replace the slots with a copy of twice the size.  The old copy stays
+valid, lookups that are still running through it will find every pile it
+has, and look again under the lock for the others. */
+
+bool PileTable::grow_slots(void)
+{
+	PILESLOTS *t, *old;
+	const PILE *p;
+	size_t i, j, mask;
+	int bits;
+
+	old = Slots.load();
+	bits = old ? 32 - old->shift + 1 : PILE_INITIAL_BITS;
+	if (bits > 31) {
+		return false;
+	}
+
+	t = (PILESLOTS *)MemoryManager::allocate_memory(sizeof(PILESLOTS));
+	if (t == NULL) {
+		return false;
+	}
+	t->entries = (QAtomicPointer<PILE> *)MemoryManager::allocate_memory(
+		sizeof(QAtomicPointer<PILE>) << bits);
+	if (t->entries == NULL) {
+		MemoryManager::free_memory(t, sizeof(PILESLOTS));
+		return false;
+	}
+	t->size = (size_t)1 << bits;
+	t->shift = 32 - bits;
+	t->next = old;
+	Bytes.store(Bytes.load() + sizeof(PILESLOTS) + (sizeof(QAtomicPointer<PILE>) << bits));
+
+	mask = t->size - 1;
+	for (i = 0; old && i < old->size; i++) {
+		p = old->entries[i].load();
+		if (p == NULL) {
+			continue;
+		}
+		j = (quint32)(p->hash * PILE_MULTIPLIER) >> t->shift;
+		while (t->entries[j].load()) {
+			j = (j + 1) & mask;
+		}
+		t->entries[j].store((PILE *)p);
+	}
+
+	Slots.storeRelease(t);
+	return true;
+}
+
+/* Double the size of the index, keeping the old copy like the slots. */
+
+bool PileTable::grow_index(void)
+{
+	PILEINDEX *x, *old;
+	int size;
+
+	old = Index.load();
+	if (old && old->size > INT_MAX / 2) {
+		return false;
+	}
+	size = old ? old->size * 2 : PILE_INITIAL_INDEX;
+
+	x = (PILEINDEX *)MemoryManager::allocate_memory(sizeof(PILEINDEX));
+	if (x == NULL) {
+		return false;
+	}
+	x->piles = (PILE **)MemoryManager::allocate_memory(sizeof(PILE *) * size);
+	if (x->piles == NULL) {
+		MemoryManager::free_memory(x, sizeof(PILEINDEX));
+		return false;
+	}
+	x->size = size;
+	x->next = old;
+	Bytes.store(Bytes.load() + sizeof(PILEINDEX) + sizeof(PILE *) * size);
+	if (old) {
+		memcpy(x->piles, old->piles, sizeof(PILE *) * old->size);
+	}
+
+	Index.storeRelease(x);
+	return true;
+}
+
+/* Carve a pile out of the current chunk.  Piles are never freed one by
+one, only all together in clear(). */
+
+PILE *PileTable::new_pile(int size)
+{
+	size_t s;
+	quint8 *c;
+	PILE *p;
+
+	s = sizeof(PILE) + size;
+	s = (s + PILE_ALIGN - 1) & ~(size_t)(PILE_ALIGN - 1);
+	if (s > Chunkleft) {
+		c = (quint8 *)MemoryManager::allocate_memory(PILE_CHUNK);
+		if (c == NULL) {
+			return NULL;
+		}
+		*(quint8 **)c = Chunks;
+		Chunks = c;
+		Chunk = c + PILE_ALIGN;
+		Chunkleft = PILE_CHUNK - PILE_ALIGN;
+		Bytes.store(Bytes.load() + PILE_CHUNK);
+	}
+
+	p = (PILE *)Chunk;
+	Chunk += s;
+	Chunkleft -= s;
+
+	return p;
+}
+
+void PileTable::clear(void)
+{
+	PILESLOTS *t;
+	PILEINDEX *x;
+	quint8 *c;
+
+	while ((t = Slots.load()) != NULL) {
+		Slots.store(t->next);
+		MemoryManager::free_memory(t->entries, sizeof(QAtomicPointer<PILE>) * t->size);
+		MemoryManager::free_memory(t, sizeof(PILESLOTS));
+	}
+	while ((x = Index.load()) != NULL) {
+		Index.store(x->next);
+		MemoryManager::free_memory(x->piles, sizeof(PILE *) * x->size);
+		MemoryManager::free_memory(x, sizeof(PILEINDEX));
+	}
+	while ((c = Chunks) != NULL) {
+		Chunks = *(quint8 **)c;
+		MemoryManager::free_memory(c, PILE_CHUNK);
+	}
+
+	Count = 0;
+	Bytes.store(0);
+	Chunk = NULL;
+	Chunkleft = 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 1998-2002 Tom Holroyd <tomh@kurage.nimh.nih.gov>
+ * Copyright (C) 2006-2009 Stephan Kulow <coolo@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PILETABLE_H
+#define PILETABLE_H
+
+#include "cardset.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QMutex>
+#include <QtCore/QtGlobal>
+
+#include <sys/types.h>
+
+/* How the cards of the runs follow each other in the games whose piles
+build down in runs.  The table keeps a run as its first card and its length
+instead of all its cards, and when the run alternates colors, with one bit
+for each following card to tell the two suits of its color apart. */
+enum PileRuns {
+	NoRuns,                 /* every card is kept */
+	SameSuitRuns,           /* down in suit, as in Spider */
+	AlternateColorRuns      /* down in alternate colors, as in Yukon */
+};
+
+/* A pile that has been given an id.  The cards follow the struct, with
+the runs in them packed, see PileTable::unpack(). */
+struct PILE {
+	quint32 hash;           /* the pile's hash code */
+	int id;                 /* the unique id for this pile */
+	int len;                /* the number of cards in it */
+	int size;               /* the bytes they take after the runs are packed */
+	cardset_t set;          /* the cards in it */
+
+	const quint8 *data() const { return (const quint8 *)(this + 1); }
+};
+
+/* One generation of the open addressing table.  When it fills up, a copy
+twice the size takes its place, but it stays around until the table is
+cleared, since lookups may still be running through it. */
+struct PILESLOTS {
+	QAtomicPointer<PILE> *entries;
+	size_t size;            /* always a power of two */
+	int shift;              /* 32 - log2(size) */
+	PILESLOTS *next;        /* the older generations */
+};
+
+/* The piles by id.  Like the slots, it is replaced by a bigger copy. */
+struct PILEINDEX {
+	PILE **piles;
+	int size;
+	PILEINDEX *next;        /* the older copies */
+};
+
+/* How the lookups of one solver went, and how full the table got. */
+struct PILESTATS {
+	quint64 lookups;        /* calls to PileTable::find() */
+	quint64 probes;         /* slots looked at by them */
+	int maxprobe;           /* the longest probe sequence */
+	int piles;              /* different piles seen */
+	size_t size;            /* the size of the table */
+};
+
+/* The table of all the different piles of a search.  Every pile gets a
+32 bit id, which is what goes into the packed positions.  The table can be
+shared by the workers of a parallel search: lookups don't take a lock,
+only inserts do, and they are rare -- even long searches see no more than
+a few ten thousand different piles, but look them up millions of times. */
+
+class PileTable
+{
+public:
+    PileTable();
+    ~PileTable();
+
+    /* Return the id of the pile, adding it if it's new, or -1 if there
+       is no memory left.  The probes are counted in stats. */
+    int find(const quint8 *cards, int len, quint32 hash, PILESTATS *stats);
+
+    /* The pile with this id. */
+    const PILE *pile(int id) const { return Index.loadAcquire()->piles[id]; }
+
+    /* Copy the cards of a pile to cards, unpacking its runs. */
+    void unpack(const PILE *p, quint8 *cards) const;
+
+    /* Keep the runs of the piles packed.  This must be set before the
+       first pile goes in. */
+    void setRuns(PileRuns runs) { Runs = runs; }
+    PileRuns runs() const { return Runs; }
+
+    int count() const { return Count; }
+    size_t size() const;
+
+    /* The bytes taken by the piles and the table. */
+    quint64 memory() const { return Bytes.load(); }
+
+    /* Forget all piles.  This must not run concurrently with find(). */
+    void clear(void);
+
+private:
+    const PILE *lookup(PILESLOTS *t, const quint8 *cards, int len,
+                       quint32 hash, size_t *slot, int *probes) const;
+    bool same(const PILE *p, const quint8 *cards) const;
+    int run_length(const quint8 *cards, int len) const;
+    int pack(const quint8 *cards, int len, quint8 *data) const;
+    bool grow_slots(void);
+    bool grow_index(void);
+    PILE *new_pile(int size);
+
+    QAtomicPointer<PILESLOTS> Slots;    /* the current generation */
+    QAtomicPointer<PILEINDEX> Index;    /* the current copy */
+    int Count;
+    PileRuns Runs;
+
+    quint8 *Chunks;                     /* the piles are carved out of these,
+                                           linked through their first word */
+    quint8 *Chunk;
+    size_t Chunkleft;
+
+    QMutex Insertmutex;                 /* serializes the inserts */
+    QAtomicInteger<quint64> Bytes;      /* for memory(), changed under it */
+};
+
+#endif // PILETABLE_H
@@ -336,7 +336,7 @@ int SimonSolver::getOuts()
 }
 
 SimonSolver::SimonSolver(const Simon *dealer)
-    : Solver()
+    : SolverCore<SimonSolver>()
 {
     setNumberPiles( 10 );
     deal = dealer;
@@ -416,3 +416,5 @@ MoveHint SimonSolver::translateMove( const MOVE &m )
     Q_ASSERT( m.to < 10 );
     return MoveHint( card, deal->store[m.to], m.pri );
 }
+
+template class SolverCore<SimonSolver>;
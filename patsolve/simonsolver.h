@@ -18,11 +18,11 @@
 #ifndef SIMONSOLVER_H
 #define SIMONSOLVER_H
 
-#include "patsolve.h"
+#include "solvercore.h"
 class Simon;
 
 
-class SimonSolver : public Solver
+class SimonSolver : public SolverCore<SimonSolver>
 {
 public:
     explicit SimonSolver(const Simon *dealer);
@@ -35,6 +35,7 @@ public:
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new SimonSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
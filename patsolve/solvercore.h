@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLVERCORE_H
+#define SOLVERCORE_H
+
+#include "patsolve.h"
+
+#include <QtCore/QElapsedTimer>
+
+#include <algorithm>
+
+/* Adds the time until it goes out of scope to a phase of the search, if
+the phases are timed. */
+class PhaseTimer
+{
+public:
+    PhaseTimer( bool timing, Tally &phase )
+        : m_phase( phase ), m_timing( timing )
+    {
+        if ( m_timing )
+            m_timer.start();
+    }
+
+    ~PhaseTimer()
+    {
+        if ( m_timing )
+            m_phase += m_timer.nsecsElapsed();
+    }
+
+private:
+    Tally &m_phase;
+    bool m_timing;
+    QElapsedTimer m_timer;
+};
+
+/* The search loops of a Solver, compiled for one game.  The rules of a
+game are virtual functions of Solver, which is all that the dealers and
+the rest of Solver need, but the loops call them for every move they
+generate, make and take back.  A game solver is derived from
+SolverCore<itself> and instantiates it in its own source file, where the
+loops call its rules by name: no virtual calls, and the compiler can
+inline them. */
+
+template <class Game>
+class SolverCore : public Solver
+{
+protected:
+    MOVE *get_moves(int *nmoves) Q_DECL_OVERRIDE;
+    bool solve(POSITION *parent) Q_DECL_OVERRIDE;
+    bool dfs(int depth, int budget, bool *lost) Q_DECL_OVERRIDE;
+
+private:
+    Game *game() { return static_cast<Game *>(this); }
+    void take_back(MOVE *m);
+};
+
+/* Generate an array of the moves we can make from this position. */
+
+template <class Game>
+MOVE *SolverCore<Game>::get_moves(int *nmoves)
+{
+	PhaseTimer timer(m_timing, Stats.movegen_ns);
+	int n, a = 0, numout = 0;
+
+	/* Fill in the Possible array. */
+
+	n = game()->Game::get_possible_moves(&a, &numout);
+	Q_ASSERT(n <= MAXMOVES);
+	if (debug) {
+		print_moves(n);
+	}
+
+	/* No moves?  Maybe we won. */
+
+	if (n == 0) {
+		return NULL;
+	}
+
+	/* Prioritize these moves.  Automoves don't get queued, so they
+	don't need a priority, and they are the only moves there are. */
+
+	if (!a) {
+		game()->Game::prioritize(Possible, n);
+	}
+
+	return save_moves(n, a ? 0 : numout, nmoves);
+}
+
+/* Generate all the successors to a position and either queue them or
+recursively solve them.  Return whether any of the child nodes, or their
+descendents, were queued or not (if not, the position can be freed). */
+
+template <class Game>
+bool SolverCore<Game>::solve(POSITION *parent)
+{
+	int i, nmoves, qq, outs;
+	MOVE *mp, *mp0;
+	POSITION *pos;
+	bool q;
+
+	if (!may_expand()) {
+		return false;
+	}
+
+	/* Remember how we got to the position with the most cards out. */
+
+	outs = game()->Game::getOuts();
+	if (outs > (int)Stats.bestouts) {
+		Stats.bestouts = outs;
+		best(parent);
+	}
+
+	/* Generate an array of all the moves we can make. */
+
+	if ((mp0 = SolverCore::get_moves(&nmoves)) == NULL) {
+		if (game()->Game::isWon()) {
+			Status = SolutionExists;
+			win(parent);
+		}
+		return false;
+	}
+
+	if (parent->depth == 0) {
+		Q_ASSERT(firstMoves.count() == 0);
+		for (i = 0; i < nmoves; ++i) {
+			firstMoves.append(Possible[i]);
+		}
+		if (m_listener) {
+			m_listener->firstMovesFound(firstMoves);
+		}
+	}
+
+	/* Other workers may finish off the queued children while we are
+	still busy with the rest; in a parallel search the parent holds on
+	to itself until the end, so they can't free it under our feet. */
+
+	parent->nchild = nmoves + (m_pool ? 1 : 0);
+
+	/* Make each move and either solve or queue the result. */
+
+	q = false;
+	for (i = 0, mp = mp0; i < nmoves; ++i, ++mp) {
+		{
+			PhaseTimer timer(m_timing, Stats.makemove_ns);
+			game()->Game::make_move(mp);
+		}
+
+		/* Calculate indices for the new piles, and see if this is
+		a new position. */
+
+		{
+			PhaseTimer timer(m_timing, Stats.insert_ns);
+			pilesort();
+			pos = new_position(parent, mp, game()->Game::getClusterNumber());
+		}
+		if (pos == NULL) {
+			take_back(mp);
+			drop_child(parent);
+			continue;
+		}
+
+		/* If this position is in a new cluster, a card went out.
+		Don't queue it, just keep going.  A larger cutoff can also
+		force a recursive call, which can help speed things up (but
+		reduces the quality of solutions).  Otherwise, save it for
+		later. */
+
+		if (pos->cluster != parent->cluster || !nmoves) {
+			qq = SolverCore::solve(pos);
+			take_back(mp);
+			if (!qq) {
+				free_position(pos, false);
+			}
+			q |= (bool)qq;
+		} else {
+			queue_position(pos, mp->pri, game()->Game::getOuts());
+			take_back(mp);
+			q = true;
+		}
+	}
+	mm->free_array(mp0, nmoves);
+
+	/* Return true if this position needs to be kept around. */
+	return let_go(parent, q);
+}
+
+/* undo_move(), timed with the moves. */
+
+template <class Game>
+void SolverCore<Game>::take_back(MOVE *m)
+{
+	PhaseTimer timer(m_timing, Stats.makemove_ns);
+	game()->Game::undo_move(m);
+}
+
+static inline bool better_move(const MOVE &a, const MOVE &b)
+{
+	return b < a;
+}
+
+/* Search the moves from the current position with budget moves left that
+don't take a card out.  Return true if there is a win, and tell in lost
+if there is none whatever the budget.  See Solver::depth_first(). */
+
+template <class Game>
+bool SolverCore<Game>::dfs(int depth, int budget, bool *lost)
+{
+	int i, nmoves, outs, cost;
+	MOVE *mp, *mp0;
+	TTENTRY *e;
+	quint64 print;
+	bool won, dead, childlost;
+
+	*lost = false;
+	if (Status != NoSolutionExists) {
+		return false;
+	}
+	++Stats.expanded;
+
+	if (interrupted((Stats.expanded & 0x3F) == 0)) {
+		return false;
+	}
+	if (max_positions != -1 &&
+	    Stats.positions - Startpositions > (quint64)max_positions) {
+		Status = MemoryLimitReached;
+		return false;
+	}
+	outs = game()->Game::getOuts();
+	if (outs > (int)Stats.bestouts) {
+		Stats.bestouts = outs;
+		bestMoves = Line;
+	}
+
+	if ((mp0 = SolverCore::get_moves(&nmoves)) == NULL) {
+		if (game()->Game::isWon()) {
+			Status = SolutionExists;
+			winMoves = Line;
+			return true;
+		}
+		*lost = Status == NoSolutionExists;
+		return false;
+	}
+
+	if (depth == 0 && firstMoves.isEmpty()) {
+		for (i = 0; i < nmoves; ++i) {
+			firstMoves.append(Possible[i]);
+		}
+		if (m_listener) {
+			m_listener->firstMovesFound(firstMoves);
+		}
+	}
+
+	/* Try the best moves first, the way the queues would. */
+
+	std::stable_sort(mp0, mp0 + nmoves, better_move);
+
+	won = false;
+	dead = true;
+	for (i = 0, mp = mp0; i < nmoves && Status == NoSolutionExists; ++i, ++mp) {
+		{
+			PhaseTimer timer(m_timing, Stats.makemove_ns);
+			game()->Game::make_move(mp);
+		}
+		{
+			PhaseTimer timer(m_timing, Stats.insert_ns);
+			pilesort();
+			print = position_print(game()->Game::getClusterNumber());
+			e = Table.find(print);
+		}
+		++Stats.generated;
+		cost = game()->Game::getOuts() > outs ? 0 : 1;
+
+		/* A position that is lost for good doesn't need a budget. */
+
+		if (e && e->budget == TT_LOST) {
+			++Stats.duplicates;
+			take_back(mp);
+			continue;
+		}
+		if (cost > budget) {
+			Cut = true;
+			dead = false;
+			take_back(mp);
+			continue;
+		}
+		if (e && (e->onpath || (e->iteration == Iteration &&
+		                        e->budget >= budget - cost))) {
+			++Stats.duplicates;
+			dead = false;
+			take_back(mp);
+			continue;
+		}
+
+		++Stats.positions;
+		Stats.depthsum += depth + 1;
+		e = Table.store(print, Iteration);
+		e->budget = budget - cost;
+		e->iteration = Iteration;
+		e->onpath = 1;
+
+		Line.append(*mp);
+		won = SolverCore::dfs(depth + 1, budget - cost, &childlost);
+		Line.removeLast();
+		take_back(mp);
+
+		/* The entry may have gone to another position meanwhile. */
+
+		if ((e = Table.find(print)) != NULL) {
+			e->onpath = 0;
+			if (childlost) {
+				e->budget = TT_LOST;
+			}
+		}
+		if (won) {
+			break;
+		}
+		dead = dead && childlost;
+	}
+	mm->free_array(mp0, nmoves);
+
+	*lost = dead && !won && Status == NoSolutionExists;
+	return won;
+}
+
+#endif // SOLVERCORE_H
@@ -66,14 +66,14 @@ void SpiderSolver::make_move(MOVE *m)
             return;
         }
 	if (m->totype == O_Type) {
-            O[to] = SUIT( *Wp[from] );
+            O[to] = *Wp[from] & PS_SUIT;
             Wlen[from] -= 13;
             Wp[from] -= 13;
-            hashpile( from );
             if ( Wlen[from] && DOWN( *Wp[from] ) )
             {
                 *Wp[from] = ( SUIT( *Wp[from] ) << 4 ) + RANK( *Wp[from] );
             }
+            hashpile( from );
 #if PRINT
             print_layout();
 #endif
@@ -245,7 +245,7 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
             mp->from = w;
             int o = 0;
             while ( O[o] != -1 )
-                o++; // TODO I need a way to tell spades off from heart off
+                o++;
             mp->to = o;
             mp->totype = O_Type;
             mp->pri = 128;
@@ -288,146 +288,105 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
     bool foundgood = false;
     int toomuch = 0;
 
+    /* Only the run on top of a pile can move, and it is known by its top
+       card and its length, conti[i].  Of its cards, the one that fits on a
+       pile is found from the ranks, so the splits needn't all be tried.
+       A run is only split to go onto a card of its own suit, where its
+       cards stay in a run; anywhere else the whole run goes or nothing.
+       So an empty pile only gets whole runs, and only the first empty pile
+       is tried, since they are all alike. */
     for(int i=0; i<10; ++i)
     {
-        int len = Wlen[i];
-        for (int l=0; l < len; ++l )
-        {
-            card_t card = W[i][Wlen[i]-1-l];
-            if ( DOWN( card ) )
-                break;
-
-            if ( l > 0 ) {
-                card_t card_on_top = W[i][Wlen[i]-l];
-		//printcard(card_on_top, stderr);
-                if ( RANK( card ) != RANK( card_on_top ) + 1 ) {
-                    break;
-                }
-                if ( SUIT( card ) != SUIT( card_on_top ) )
-                    break;
-            }
+        if ( !Wlen[i] || DOWN( *Wp[i] ) )
+            continue;
 
-            bool wasempty = false;
-            for (int j = 0; j < 10; ++j)
+        /* The piles that take a card of the run, in the order of the
+           cards, and which card that is. */
+        int top = RANK( *Wp[i] );
+        int fits[10], order[10];
+        int m = 0;
+        bool wasempty = false;
+        for (int j = 0; j < 10; ++j)
+        {
+            if ( i == j )
+                continue;
+            int l;
+            if ( Wlen[j] > 0 )
             {
-                if (i == j)
+                l = RANK( *Wp[j] ) - 1 - top;
+                if ( l < 0 || l >= conti[i] )
+                    continue;
+            } else {
+                if ( wasempty || conti[i] == Wlen[i] )
                     continue;
+                l = conti[i] - 1;
+                wasempty = true;
+            }
+            fits[j] = l;
+            int k = m++;
+            for ( ; k > 0 && fits[order[k-1]] > l; --k )
+                order[k] = order[k-1];
+            order[k] = j;
+        }
 
-                bool allowed = false;
+        for (int k = 0; k < m; ++k)
+        {
+            int j = order[k];
+            int l = fits[j];
 
-                if ( Wlen[j] > 0 &&
-                     RANK(card) == RANK(*Wp[j]) - 1 )
-                {
-                    allowed = true;
+            card_t card = W[i][Wlen[i]-1-l];
+            bool split = l < conti[i] - 1;
+
+            if ( Wlen[j] > 0 && SUIT( card ) != SUIT( *Wp[j] ) )
+            {
+                if ( split )
+                    continue;
 #if 1
-                    // too bad: see bug 175945
-                    if ( ( SUIT( card ) != SUIT( *Wp[j] ) ) && ( foundgood && Wlen[i] > l + 1 && l > 0 ))
-                        allowed = false; // make the tree simpler
+                // too bad: see bug 175945
+                if ( foundgood && Wlen[i] > l + 1 && l > 0 )
+                    continue; // make the tree simpler
 #endif
-                }
-                if ( Wlen[j] == 0 && !wasempty )
-                {
-                    if ( l != Wlen[i]-1  ) {
-                        allowed = true;
-                        wasempty = true;
-                    }
-                }
-                if ( allowed && Wlen[i] >= l+2 && Wlen[i] > 1 )
+            }
+
+            mp->card_index = l;
+            mp->from = i;
+            mp->to = j;
+            mp->totype = W_Type;
+            mp->turn_index = -1;
+            if ( Wlen[i] > l+1 && DOWN( W[i][Wlen[i]-l-2] ) )
+                mp->turn_index = 1;
+            int cont = conti[j];
+            if ( Wlen[j] )
+                cont++;
+            if ( cont )
+                cont += l;
+            mp->pri = 8 * cont + qMax( 0, 10 - Wlen[i] );
+            if ( Wlen[j] )
+            {
+                if ( SUIT( card ) != SUIT( *Wp[j] ) )
+                    mp->pri /= 2;
+                else if ( split && ( conti[j]+l+1 != 13 || conti[i]>conti[j]+l ) )
                 {
-                    Q_ASSERT( Wlen[i]-l-2 >= 0 );
-                    card_t card_below = W[i][Wlen[i]-l-2];
-                    if ( SUIT( card ) == SUIT( card_below ) &&
-                         !DOWN( card_below ) &&
-                         RANK( card_below ) == RANK( card ) + 1 )
-                    {
-#if 0
-                        printcard( card_below, stderr );
-                        printcard( card, stderr );
-                        fprintf( stderr, "%d %d %d %d %d\n", i, j, conti[i], conti[j],l );
-#endif
-                        if ( SUIT( card ) != SUIT( *Wp[j] ) )
-                        {
-			  //fprintf( stderr, "continue %d %d %d %d\n",conti[j]+l, conti[i],conti[j]+l, SUIT( card ) != SUIT( *Wp[j] ) );
-                            continue;
-                        }
+                    /* The run goes from one card of a suit to its twin,
+                       which rarely helps, unless it makes a whole suit. */
+                    toomuch++;
+                    mp->pri = -40;
+                } else
+                    foundgood = true;
+            } else
+                mp->pri = 2; // TODO: it should depend on the actual stack's order
+            if ( mp->turn_index > 0)
+                mp->pri = qMin( 127, mp->pri + 7 );
+            else if ( Wlen[i] == l+1 )
+                mp->pri = qMin( 127, mp->pri + 4 );
+            else
+                mp->pri = qMin( 127, mp->pri + 2 );
 
-#if 1
-                        // too bad: see bug 175945
-                        if ( conti[j]+l+1 != 13 || conti[i]>conti[j]+l )
-                        {
-                            //fprintf( stderr, "continue %d %d %d %d\n",conti[j]+l, conti[i],conti[j]+l, SUIT( card ) != SUIT( *Wp[j] ) );
-                            //continue;
-                        }
-#endif
-                    }
-                }
+            /* and the cards of the run it leaves behind */
+            mp->pri = qMin( 127, mp->pri + 5 * ( conti[i] - l - 2 ) );
 
-                if ( allowed ) {
-                    mp->card_index = l;
-                    mp->from = i;
-                    mp->to = j;
-                    mp->totype = W_Type;
-                    mp->turn_index = -1;
-                    if ( Wlen[i] > l+1 && DOWN( W[i][Wlen[i]-l-2] ) )
-                        mp->turn_index = 1;
-                    int cont = conti[j];
-                    if ( Wlen[j] )
-                        cont++;
-                    if ( cont )
-                        cont += l;
-                    mp->pri = 8 * cont + qMax( 0, 10 - Wlen[i] );
-                    if ( Wlen[j] )
-                    {
-                        if ( SUIT( card ) != SUIT( *Wp[j] ) )
-                            mp->pri /= 2;
-                        else {
-                            if ( conti[j]+l+1 != 13 || conti[i]>conti[j]+l )
-                            {
-                                card_t card_below = W[i][Wlen[i]-l-2];
-                                if ( SUIT( card_below ) != SUIT( card ) || RANK(card_below) != RANK(card) + 1 )
-                                {
-                                    foundgood = true;
-                                } else {
-                                    toomuch++;
-                                    mp->pri = -40;
-                                }
-                            } else
-                                foundgood = true;
-                        }
-                    } else
-                        mp->pri = 2; // TODO: it should depend on the actual stack's order
-                    if ( mp->turn_index > 0)
-                        mp->pri = qMin( 127, mp->pri + 7 );
-                    else if ( Wlen[i] == l+1 )
-                        mp->pri = qMin( 127, mp->pri + 4 );
-                    else
-                        mp->pri = qMin( 127, mp->pri + 2 );
-
-                    /* and now check what sequence we open */
-                    int conti_pos = l;
-                    for ( ; conti_pos < Wlen[i]-1; ++conti_pos )
-                    {
-                        card_t theone = W[i][Wlen[i]-conti_pos-1];
-                        card_t below = W[i][Wlen[i]-conti_pos-2];
-#if 0
-			fprintf(stderr, "checking pile%d len:%d prio:%d ", i, l, mp->pri);
-                        printcard( card, stderr );
-                        printcard( theone, stderr );
-                        printcard( below, stderr );
-                        fputc( '\n', stderr );
-#endif
-                        if ( SUIT( card ) != SUIT( below ) || DOWN( below ) )
-                            break;
-                        if ( RANK( theone ) !=
-                             RANK( below ) - 1)
-                            break;
-                    }
-                    mp->pri = qMin( 127, mp->pri + 5 * ( conti_pos - l - 1 ) );
-
-                    n++;
-                    mp++;
-                }
-            }
+            n++;
+            mp++;
         }
     }
 
@@ -480,14 +439,14 @@ int SpiderSolver::get_possible_moves(int *a, int *numout)
 
 void SpiderSolver::unpack_cluster( unsigned int k )
 {
-    // TODO: this only works for easy
-    for ( unsigned int i = 0; i < 8; ++i )
-    {
-        if ( i < k )
-            O[i] = PS_SPADE;
-        else
-            O[i] = -1;
-    }
+    /* The legs are filled from the first one, and which suit went out
+       first doesn't matter. */
+    int o = 0;
+    for ( int s = 0; s < 4; ++s )
+        for ( unsigned int n = ( k >> ( s * 4 ) ) & 0xF; n > 0; --n )
+            O[o++] = s << 4;
+    while ( o < 8 )
+        O[o++] = -1;
 }
 
 bool SpiderSolver::isWon()
@@ -513,10 +472,11 @@ int SpiderSolver::getOuts()
 }
 
 SpiderSolver::SpiderSolver(const Spider *dealer)
-    : Solver()
+    : SolverCore<SpiderSolver>()
 {
     // 10 play + 5 redeals
     setNumberPiles( 15 );
+    setPileRuns( SameSuitRuns );
     deal = dealer;
 }
 
@@ -542,25 +502,39 @@ void SpiderSolver::translate_layout()
         total += i;
     }
 
+    int o = 0;
     for (int i = 0; i < 8; ++i) {
-        O[i] = -1;
         KCard *c = deal->legs[i]->topCard();
         if (c) {
             total += 13;
-            O[i] = translateSuit( c->suit() );
+            O[o++] = translateSuit( c->suit() );
         }
     }
+    while ( o < 8 )
+        O[o++] = -1;
 }
 
+/* The number of legs of each suit, four bits for every suit. */
+
 unsigned int SpiderSolver::getClusterNumber()
 {
     unsigned int k = 0;
     for ( int i = 0; i < 8; ++i )
         if ( O[i] != -1 )
-            k++;
+            k += 1 << ( SUIT( O[i] ) * 4 );
     return k;
 }
 
+/* The legs of suit s become those of perm[s]. */
+
+unsigned int SpiderSolver::suit_cluster( unsigned int k, const int *perm )
+{
+    unsigned int n = 0;
+    for ( int s = 0; s < 4; ++s )
+        n |= ( ( k >> ( s * 4 ) ) & 0xF ) << ( perm[s] * 4 );
+    return n;
+}
+
 void SpiderSolver::print_layout()
 {
     int i, w, o;
@@ -606,3 +580,5 @@ MoveHint SpiderSolver::translateMove( const MOVE &m )
     Q_ASSERT( m.to < 10 );
     return MoveHint( card, deal->stack[m.to], m.pri );
 }
+
+template class SolverCore<SpiderSolver>;
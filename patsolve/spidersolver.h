@@ -18,11 +18,11 @@
 #ifndef SPIDERSOLVER_H
 #define SPIDERSOLVER_H
 
-#include "patsolve.h"
+#include "solvercore.h"
 class Spider;
 
 
-class SpiderSolver : public Solver
+class SpiderSolver : public SolverCore<SpiderSolver>
 {
 public:
     explicit SpiderSolver(const Spider *dealer);
@@ -34,13 +34,15 @@ public:
     unsigned int getClusterNumber() Q_DECL_OVERRIDE;
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
+    unsigned int suit_cluster( unsigned int k, const int *perm ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new SpiderSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
 /* Names of the cards.  The ordering is defined in pat.h. */
 
-    int O[8];
+    int O[8]; /* the suit of each leg (as in a card), or -1 */
     const Spider *deal;
 };
 
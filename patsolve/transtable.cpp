@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "transtable.h"
+
+#include "memory.h"
+
+
+#define TT_MINBITS 12
+
+TranspositionTable::TranspositionTable()
+    : Entries(NULL),
+      Size(0),
+      Shift(0)
+{
+}
+
+TranspositionTable::~TranspositionTable()
+{
+	clear();
+}
+
+bool TranspositionTable::init(size_t bytes)
+{
+	int bits;
+
+	clear();
+	for (bits = TT_MINBITS; (sizeof(TTENTRY) << (bits + 1)) <= bytes && bits < 30; bits++) {
+	}
+	Entries = (TTENTRY *)MemoryManager::allocate_memory(sizeof(TTENTRY) << bits);
+	if (Entries == NULL) {
+		return false;
+	}
+	Size = (size_t)1 << bits;
+	Shift = 64 - (bits - 1);
+	return true;
+}
+
+void TranspositionTable::clear(void)
+{
+	if (Entries) {
+		MemoryManager::free_memory(Entries, memory());
+	}
+	Entries = NULL;
+	Size = 0;
+}
+
+/* The two entries a position can go to, picked by the high bits of the
+print.  Those of the FNV hash are the best mixed. */
+
+TTENTRY *TranspositionTable::bucket(quint64 print) const
+{
+	return &Entries[(size_t)(print >> Shift) * 2];
+}
+
+TTENTRY *TranspositionTable::find(quint64 print)
+{
+	TTENTRY *b = bucket(print);
+
+	if (b[0].print == print) {
+		return &b[0];
+	}
+	if (b[1].print == print) {
+		return &b[1];
+	}
+	return NULL;
+}
+
+/* What an entry is worth keeping. */
+
+static int worth(const TTENTRY *e, int iteration)
+{
+	if (e->print == 0) {
+		return -1;
+	}
+	if (e->budget == TT_LOST) {
+		return TT_LOST;
+	}
+	return e->iteration == (quint16)iteration ? e->budget : 0;
+}
+
+TTENTRY *TranspositionTable::store(quint64 print, int iteration)
+{
+	TTENTRY *b = bucket(print);
+	TTENTRY *e;
+
+	if (b[0].print == print) {
+		return &b[0];
+	}
+	if (b[1].print == print) {
+		return &b[1];
+	}
+
+	if (b[0].onpath != b[1].onpath) {
+		e = b[0].onpath ? &b[1] : &b[0];
+	} else {
+		e = worth(&b[0], iteration) <= worth(&b[1], iteration) ? &b[0] : &b[1];
+	}
+	e->print = print;
+	e->budget = 0;
+	e->iteration = iteration;
+	e->onpath = 0;
+	return e;
+}
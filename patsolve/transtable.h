@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSTABLE_H
+#define TRANSTABLE_H
+
+#include <QtCore/QtGlobal>
+
+#include <sys/types.h>
+
+/* What the depth-first search knows about a position. */
+struct TTENTRY {
+	quint64 print;          /* a hash of the position, 0 if the entry is free */
+	qint16 budget;          /* the moves it was searched with, or TT_LOST */
+	quint16 iteration;      /* the search it was stored by */
+	quint16 onpath;         /* it is being searched right now */
+	quint16 pad;
+};
+
+/* The position can't be won, whatever the budget. */
+#define TT_LOST 0x7FFF
+
+/* The transposition table of the depth-first search.  Its size is fixed
+when the search starts, it never grows: a new position takes the place of
+an old one in its bucket of two.  An entry that is lost for good, or that
+was searched with a larger budget in this iteration, is worth more than
+one that was cheap to find, and the positions on the current line are
+only replaced if both entries of the bucket are on it.  What is replaced
+just has to be searched again. */
+
+class TranspositionTable
+{
+public:
+    TranspositionTable();
+    ~TranspositionTable();
+
+    /* Make room for as many positions as fit in bytes, but at least a few
+       thousand.  Return false if there is no memory left. */
+    bool init(size_t bytes);
+    void clear(void);
+
+    /* The entry of a position, or NULL if it isn't in the table. */
+    TTENTRY *find(quint64 print);
+
+    /* Add a position for the given iteration of the search, or give
+       back its entry if it's there already. */
+    TTENTRY *store(quint64 print, int iteration);
+
+    /* The bytes taken by the table. */
+    quint64 memory() const { return Size * sizeof(TTENTRY); }
+
+private:
+    TTENTRY *bucket(quint64 print) const;
+
+    TTENTRY *Entries;
+    size_t Size;            /* always a power of two */
+    int Shift;              /* 64 - log2(Size / 2) */
+};
+
+#endif // TRANSTABLE_H
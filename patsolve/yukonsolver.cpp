@@ -200,10 +200,20 @@ int YukonSolver::good_automove(int o, int r)
 
 int YukonSolver::get_possible_moves(int *a, int *numout)
 {
-    int w, o, empty;
+    int w, o;
     card_t card;
+    cardset_t out, fits;
     MOVE *mp;
 
+    /* The cards that can go out, see cardset.h. */
+
+    out = 0;
+    for (o = 0; o < 4; ++o) {
+        if (O[o] != PS_KING) {
+            out |= card_bit(Osuit[o] + O[o] + 1);
+        }
+    }
+
     /* Check for moves from W to O. */
 
     int n = 0;
@@ -212,9 +222,7 @@ int YukonSolver::get_possible_moves(int *a, int *numout)
         if (Wlen[w] > 0) {
             card = *Wp[w];
             o = SUIT(card);
-            empty = (O[o] == NONE);
-            if ((empty && (RANK(card) == PS_ACE)) ||
-                (!empty && (RANK(card) == O[o] + 1))) {
+            if (card_bit(card) & out) {
                 mp->card_index = 0;
                 mp->from = w;
                 mp->to = o;
@@ -246,14 +254,33 @@ int YukonSolver::get_possible_moves(int *a, int *numout)
     *a = false;
     *numout = n;
 
+    // the cards that fit on the top of a pile, and the kings if there is
+    // an empty one; a pile with none of them has nothing to move
+    fits = 0;
+    bool anyempty = false;
+    for (w = 0; w < 7; ++w) {
+        if ( Wlen[w] > 0 )
+            fits |= card_bit( *Wp[w] );
+        else
+            anyempty = true;
+    }
+    fits = set_fits_alternate( fits );
+    if ( anyempty )
+        fits |= set_of_rank( PS_KING );
+
     for(int i=0; i<7; ++i)
     {
+        if ( !( Wset[i] & fits ) )
+            continue;
+
         int len = Wlen[i];
         for (int l=0; l < len; ++l )
         {
             card_t card = W[i][Wlen[i]-1-l];
             if ( DOWN( card ) )
                 break;
+            if ( !( card_bit( card ) & fits ) )
+                continue;
 
             for (int j = 0; j < 7; ++j)
             {
@@ -273,14 +300,27 @@ int YukonSolver::get_possible_moves(int *a, int *numout)
                         if ( DOWN( W[i][Wlen[i]-l-2] ) )
                             allowed = 3;
                     }
+
+                    /* The card sits on a card it fits on already, and
+                       the one it would go to is that card's twin, with
+                       the same rank and color.  The twins can take the
+                       same cards, and either one can move with what's on
+                       it, so swapping the one that is covered only helps
+                       if the uncovered one can go out. */
+                    if ( allowed == 1 )
+                    {
+                        card_t below = W[i][Wlen[i]-l-2];
+                        if ( RANK( below ) == RANK( card ) + 1 &&
+                             suitable( card, below ) &&
+                             !( card_bit( below ) & out ) )
+                            allowed = 0;
+                    }
                 }
                 if ( RANK( card ) == PS_KING && Wlen[j] == 0 )
                 {
                     if ( l != Wlen[i]-1 || i == 7 )
                         allowed = 4;
                 }
-                // TODO: there is no point in moving if we're not opening anything
-                // e.g. if both i and j have perfect runs below the cards
 #if 0
                 fprintf( stderr, "%d %d %d\n", i, l, j );
                 printcard( card, stderr );
@@ -339,7 +379,7 @@ int YukonSolver::getOuts()
 }
 
 YukonSolver::YukonSolver(const Yukon *dealer)
-    : Solver()
+    : SolverCore<YukonSolver>()
 {
     Osuit[0] = PS_DIAMOND;
     Osuit[1] = PS_CLUB;
@@ -347,6 +387,7 @@ YukonSolver::YukonSolver(const Yukon *dealer)
     Osuit[3] = PS_SPADE;
 
     setNumberPiles( 7 );
+    setPileRuns( AlternateColorRuns );
     deal = dealer;
 }
 
@@ -438,3 +479,5 @@ void YukonSolver::print_layout()
     }
     fprintf(stderr, "\nprint-layout-end\n");
 }
+
+template class SolverCore<YukonSolver>;
@@ -18,11 +18,11 @@
 #ifndef YUKONSOLVER_H
 #define YUKONSOLVER_H
 
-#include "patsolve.h"
+#include "solvercore.h"
 class Yukon;
 
 
-class YukonSolver : public Solver
+class YukonSolver : public SolverCore<YukonSolver>
 {
 public:
     explicit YukonSolver(const Yukon *dealer);
@@ -36,6 +36,7 @@ public:
     void translate_layout() Q_DECL_OVERRIDE;
     void unpack_cluster( unsigned int k ) Q_DECL_OVERRIDE;
     MoveHint translateMove(const MOVE &m) Q_DECL_OVERRIDE;
+    Solver *clone() const Q_DECL_OVERRIDE { return new YukonSolver( *this ); }
 
     void print_layout() Q_DECL_OVERRIDE;
 
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "solvercache.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
+
+#include <cstring>
+
+
+namespace
+{
+    const quint32 cacheMagic = 0x4b505343;
+    const quint32 cacheVersion = 2;
+    const int cacheSets = 256;
+    const int cacheWays = 8;
+    const int cacheMoves = 336;
+    const int lockTimeout = 100;
+}
+
+
+struct SolverCacheMove
+{
+    qint16 pri;
+    quint8 from;
+    quint8 to;
+    qint8 cardIndex;
+    qint8 turnIndex;
+    quint8 toType;
+    quint8 padding;
+};
+
+
+struct SolverCacheSlot
+{
+    quint64 fingerprint;
+    quint64 stamp;
+    qint32 gameId;
+    qint32 dealNumber;
+    qint16 result;
+    quint16 moveCount;
+    quint32 padding;
+    SolverCacheMove moves[cacheMoves];
+};
+
+
+struct SolverCacheHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotSize;
+    quint64 clock;
+    quint64 padding;
+};
+
+
+namespace
+{
+    const qint64 cacheSize = sizeof( SolverCacheHeader )
+                             + qint64( cacheSets ) * cacheWays * sizeof( SolverCacheSlot );
+
+    bool fitsInSlot( const QList<MOVE> & moves )
+    {
+        if ( moves.size() > cacheMoves )
+            return false;
+        foreach ( const MOVE & m, moves )
+        {
+            if ( m.card_index != qint8( m.card_index )
+                 || m.turn_index != qint8( m.turn_index ) )
+                return false;
+        }
+        return true;
+    }
+}
+
+
+SolverCache * SolverCache::instance()
+{
+    static SolverCache cache;
+    return &cache;
+}
+
+
+SolverCache::SolverCache()
+  : m_lock( 0 ),
+    m_data( 0 ),
+    m_failed( false )
+{
+}
+
+
+SolverCache::~SolverCache()
+{
+    if ( m_data )
+        m_file.unmap( m_data );
+    delete m_lock;
+}
+
+
+// Map the cache file, creating it if necessary. A file that was written by
+// a different version is started over.
+bool SolverCache::open()
+{
+    if ( m_data )
+        return true;
+    if ( m_failed )
+        return false;
+
+    const QString dir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+    if ( dir.isEmpty() || !QDir().mkpath( dir ) )
+    {
+        m_failed = true;
+        return false;
+    }
+
+    m_file.setFileName( dir + QLatin1String("/solver-cache") );
+    if ( !m_lock )
+    {
+        m_lock = new QLockFile( m_file.fileName() + QLatin1String(".lock") );
+        m_lock->setStaleLockTime( 10000 );
+    }
+    if ( !m_lock->tryLock( lockTimeout ) )
+        return false;
+
+    if ( !m_file.open( QIODevice::ReadWrite )
+         || ( m_file.size() != cacheSize && !m_file.resize( cacheSize ) )
+         || !( m_data = m_file.map( 0, cacheSize ) ) )
+    {
+        m_file.close();
+        m_lock->unlock();
+        m_failed = true;
+        return false;
+    }
+
+    SolverCacheHeader * header = reinterpret_cast<SolverCacheHeader*>( m_data );
+    if ( header->magic != cacheMagic
+         || header->version != cacheVersion
+         || header->slotCount != quint32( cacheSets * cacheWays )
+         || header->slotSize != sizeof( SolverCacheSlot ) )
+    {
+        memset( m_data, 0, cacheSize );
+        header->magic = cacheMagic;
+        header->version = cacheVersion;
+        header->slotCount = cacheSets * cacheWays;
+        header->slotSize = sizeof( SolverCacheSlot );
+    }
+
+    m_lock->unlock();
+    return true;
+}
+
+
+SolverCacheSlot * SolverCache::slot( int index ) const
+{
+    return reinterpret_cast<SolverCacheSlot*>( m_data + sizeof( SolverCacheHeader ) ) + index;
+}
+
+
+// A position can only be in one set of slots, picked by its fingerprint.
+SolverCacheSlot * SolverCache::find( const Key & key ) const
+{
+    const int set = ( key.fingerprint >> 40 ) % cacheSets;
+    for ( int i = 0; i < cacheWays; ++i )
+    {
+        SolverCacheSlot * s = slot( set * cacheWays + i );
+        if ( s->stamp
+             && s->fingerprint == key.fingerprint
+             && s->gameId == key.gameId
+             && s->dealNumber == key.dealNumber )
+            return s;
+    }
+    return 0;
+}
+
+
+bool SolverCache::lookup( const Key & key, Solver::ExitStatus * result, QList<MOVE> * winMoves )
+{
+    if ( !open() || !m_lock->tryLock( lockTimeout ) )
+        return false;
+
+    SolverCacheSlot * s = find( key );
+    if ( s )
+    {
+        SolverCacheHeader * header = reinterpret_cast<SolverCacheHeader*>( m_data );
+        s->stamp = ++header->clock;
+
+        *result = static_cast<Solver::ExitStatus>( s->result );
+        winMoves->clear();
+        for ( int i = 0; i < s->moveCount; ++i )
+        {
+            const SolverCacheMove & cm = s->moves[i];
+            MOVE m;
+            m.card_index = cm.cardIndex;
+            m.from = cm.from;
+            m.to = cm.to;
+            m.totype = static_cast<PileType>( cm.toType );
+            m.pri = cm.pri;
+            m.turn_index = cm.turnIndex;
+            winMoves->append( m );
+        }
+    }
+
+    m_lock->unlock();
+    return s;
+}
+
+
+// Only the final verdicts are worth keeping. If the position is new, it
+// takes the place of the least recently used one in its set.
+void SolverCache::store( const Key & key, Solver::ExitStatus result, const QList<MOVE> & winMoves )
+{
+    if ( result != Solver::SolutionExists && result != Solver::NoSolutionExists )
+        return;
+    if ( !fitsInSlot( winMoves ) )
+        return;
+    if ( !open() || !m_lock->tryLock( lockTimeout ) )
+        return;
+
+    SolverCacheSlot * s = find( key );
+    if ( !s )
+    {
+        const int set = ( key.fingerprint >> 40 ) % cacheSets;
+        s = slot( set * cacheWays );
+        for ( int i = 1; i < cacheWays; ++i )
+        {
+            SolverCacheSlot * t = slot( set * cacheWays + i );
+            if ( t->stamp < s->stamp )
+                s = t;
+        }
+    }
+
+    SolverCacheHeader * header = reinterpret_cast<SolverCacheHeader*>( m_data );
+    s->fingerprint = key.fingerprint;
+    s->stamp = ++header->clock;
+    s->gameId = key.gameId;
+    s->dealNumber = key.dealNumber;
+    s->result = result;
+    s->moveCount = winMoves.size();
+    for ( int i = 0; i < winMoves.size(); ++i )
+    {
+        const MOVE & m = winMoves.at( i );
+        SolverCacheMove & cm = s->moves[i];
+        cm.from = m.from;
+        cm.to = m.to;
+        cm.cardIndex = m.card_index;
+        cm.turnIndex = m.turn_index;
+        cm.pri = m.pri;
+        cm.toType = m.totype;
+        cm.padding = 0;
+    }
+
+    m_lock->unlock();
+}
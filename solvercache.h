@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2026 The KPat developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOLVERCACHE_H
+#define SOLVERCACHE_H
+
+#include "patsolve/patsolve.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QLockFile>
+
+struct SolverCacheHeader;
+struct SolverCacheSlot;
+
+
+// Remembers what the solver found out about a position across sessions.
+// The results live in a file of fixed size in the cache directory, which is
+// shared by all running instances: it is memory mapped, and every access
+// holds a lock file. When a set of slots is full, the least recently used
+// result is replaced.
+class SolverCache
+{
+public:
+    static SolverCache * instance();
+
+    // The key of a position. The fingerprint identifies the layout and
+    // the game specific state within a deal.
+    struct Key
+    {
+        int gameId;
+        int dealNumber;
+        quint64 fingerprint;
+    };
+
+    bool lookup( const Key & key, Solver::ExitStatus * result, QList<MOVE> * winMoves );
+    void store( const Key & key, Solver::ExitStatus result, const QList<MOVE> & winMoves );
+
+private:
+    SolverCache();
+    ~SolverCache();
+
+    bool open();
+    SolverCacheSlot * slot( int index ) const;
+    SolverCacheSlot * find( const Key & key ) const;
+
+    QFile m_file;
+    QLockFile * m_lock;
+    uchar * m_data;
+    bool m_failed;
+};
+
+#endif